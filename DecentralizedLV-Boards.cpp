@@ -66,36 +66,33 @@ void DashController_CAN::initialize(){
     bmsFaultDetected = false;
     rmsFaultDetected = false;
     boardDetected = false;
+    receiveClock.reset();
 }
 
 /// @brief Takes the variables that you've previously updated and sends them out in the agreed CAN bus format for this board.
 /// @param controller The CAN bus controller attached to this microcontroller.
 void DashController_CAN::sendCANData(CAN_Controller &controller){
-    byte tx2 = 0;
-    byte tx4 = headlight + (highbeam << 1) + (reversePress << 5);
-    byte tx5 = 0;
-    byte tx6 = driveMode;
-    byte tx7 = radiatorFan + (radiatorPump << 1);
-    controller.CANSend(boardAddress, rightTurnPWM,leftTurnPWM,tx2,batteryFanPWM,tx4,tx5,tx6,tx7);   //Send out the main message to the corner boards
+    sendBoardFrame(*this, controller);
 }
 
 /// @brief Extracts CAN frame data into the object's variables so you can use them for controlling other things
 /// @param msg The CAN frame that was received by can.receive(). Need to convert from CANMessage to LV_CANMessage by copying address and byte.
-void DashController_CAN::receiveCANData(LV_CANMessage msg){
+void DashController_CAN::receiveCANData(const LV_CANMessage &msg){
     if(msg.addr == boardAddress){   //Our message that we received was from this board. Go ahead and import the data to the packets.
         boardDetected = true;
-        rightTurnPWM = msg.byte0;
-        leftTurnPWM = msg.byte1;
-        batteryFanPWM = msg.byte3;
-        headlight = msg.byte4 & 1;
-        highbeam = (msg.byte4 >> 1) & 1;
-        reversePress = (msg.byte4 >> 5) & 1;
-        driveMode = msg.byte6;
-        radiatorFan = msg.byte7 & 1;
-        radiatorPump = (msg.byte7 >> 1) & 1;
+        receiveClock.stamp(msg);
+        Layout::unpack(msg, *this);
     }
 }
 
+/// @brief Registers this board's receiveCANData with a CAN_Dispatcher so frames on boardAddress are routed straight to it. Example: 'dispatcher.addBoard(dc);'
+/// @param dispatcher The dispatcher to register with.
+/// @return False if the dispatcher is full or already routes boardAddress.
+bool DashController_CAN::registerReceive(CAN_Dispatcher &dispatcher){
+    return dispatcher.addHandler(boardAddress, &CAN_Dispatcher::memberHandler<DashController_CAN, &DashController_CAN::receiveCANData>, this);
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////         HIGH VOLTAGE CONTROLLER FUNCTIONS        ///////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -112,27 +109,33 @@ void HVController_CAN::initialize(){
     Killswitch = false;
     BMSFault = false;
     boardDetected = false;
+    receiveClock.reset();
 }
 
 /// @brief Takes the variables that you've previously updated and sends them out in the agreed CAN bus format for this board.
 /// @param controller The CAN bus controller attached to this microcontroller.
 void HVController_CAN::sendCANData(CAN_Controller &controller){
-    byte tx0 = Killswitch + (BMSFault << 1);
-    controller.CANSend(boardAddress, tx0, 0, 0, 0, 0, 0, 0, 0);
-
+    sendBoardFrame(*this, controller);
 }
 
 /// @brief Extracts CAN frame data into the object's variables so you can use them for controlling other things
 /// @param msg The CAN frame that was received by can.receive(). Need to convert from CANMessage to LV_CANMessage by copying address and byte.
-void HVController_CAN::receiveCANData(LV_CANMessage msg){
+void HVController_CAN::receiveCANData(const LV_CANMessage &msg){
     if(msg.addr == boardAddress){
         boardDetected = true;
-        //do something with the hv controller data
-        Killswitch = msg.byte0 & 1;
-        BMSFault = (msg.byte0 >> 1) & 1;
+        receiveClock.stamp(msg);
+        Layout::unpack(msg, *this);
     }
 }
 
+/// @brief Registers this board's receiveCANData with a CAN_Dispatcher so frames on boardAddress are routed straight to it. Example: 'dispatcher.addBoard(hvc);'
+/// @param dispatcher The dispatcher to register with.
+/// @return False if the dispatcher is full or already routes boardAddress.
+bool HVController_CAN::registerReceive(CAN_Dispatcher &dispatcher){
+    return dispatcher.addHandler(boardAddress, &CAN_Dispatcher::memberHandler<HVController_CAN, &HVController_CAN::receiveCANData>, this);
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////         POWER CONTROLLER FUNCTIONS        //////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -158,38 +161,32 @@ void PowerController_CAN::initialize(){
     LowPowerMode = false;
     LowACCBattery = false;
     boardDetected = false;
+    receiveClock.reset();
 }
 
 /// @brief Takes the variables that you've previously updated and sends them out in the agreed CAN bus format for this board.
 /// @param controller The CAN bus controller attached to this microcontroller.
 void PowerController_CAN::sendCANData(CAN_Controller &controller){
-    byte tx0 = BrakeSense + (PushToStart << 1) + (ACCharge << 2) + (SolarCharge << 3) + (Horn << 4);
-    byte tx1 = Acc + (Ign << 1) + (FullStart << 2) + (CarOn << 3) + (StartUp << 4);
-    byte tx2 = LowPowerMode + (LowACCBattery << 1) + (boardDetected << 2);
-    controller.CANSend(boardAddress, tx0, tx1, tx2, 0, 0, 0, 0, 0);
+    sendBoardFrame(*this, controller);
 }
 /// @brief Extracts CAN frame data into the object's variables so you can use them for controlling other things
 /// @param msg The CAN frame that was received by can.receive(). Need to convert from CANMessage to LV_CANMessage by copying address and byte.
-void PowerController_CAN::receiveCANData(LV_CANMessage msg){
+void PowerController_CAN::receiveCANData(const LV_CANMessage &msg){
     if(msg.addr == boardAddress){
-        boardDetected = true;
-        //do something with the power controller data
-        BrakeSense = (msg.byte0) & 1;
-        PushToStart = (msg.byte0 >> 1) & 1;
-        ACCharge = (msg.byte0 >> 2) & 1;
-        SolarCharge = (msg.byte0 >> 3) & 1;
-        Horn = (msg.byte0 >> 4) & 1;
-        Acc = (msg.byte1) & 1;
-        Ign = (msg.byte1 >> 1) & 1;
-        FullStart = (msg.byte1 >> 2) & 1;
-        CarOn = (msg.byte1 >> 3) & 1;
-        StartUp = (msg.byte1 >> 4) & 1;
-        LowPowerMode = (msg.byte2) & 1;
-        LowACCBattery = (msg.byte2 >> 1) & 1;
-        boardDetected = (msg.byte2 >> 2) & 1;
+        receiveClock.stamp(msg);
+        Layout::unpack(msg, *this);
+        boardDetected = true;       //After unpack, which copies the sender's own boardDetected bit
     }
 }
 
+/// @brief Registers this board's receiveCANData with a CAN_Dispatcher so frames on boardAddress are routed straight to it. Example: 'dispatcher.addBoard(pc);'
+/// @param dispatcher The dispatcher to register with.
+/// @return False if the dispatcher is full or already routes boardAddress.
+bool PowerController_CAN::registerReceive(CAN_Dispatcher &dispatcher){
+    return dispatcher.addHandler(boardAddress, &CAN_Dispatcher::memberHandler<PowerController_CAN, &PowerController_CAN::receiveCANData>, this);
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////         REAR LEFT DRIVER FUNCTIONS        //////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -205,29 +202,65 @@ void LPDRV_RearLeft_CAN::initialize(){
     bmsFaultInput = false;
     switchFaultInput = false;
     boardDetected = false;
+    receiveClock.reset();
 }
 
 /// @brief Takes the variables that you've previously updated and sends them out in the agreed CAN bus format for this board.
 /// @param controller The CAN bus controller attached to this microcontroller.
 void LPDRV_RearLeft_CAN::sendCANData(CAN_Controller &controller){
-    controller.CANSend(boardAddress, bmsFaultInput, switchFaultInput, 0, 0, 0, 0, 0, 0);
+    sendBoardFrame(*this, controller);
 }
 
 /// @brief Extracts CAN frame data into the object's variables so you can use them for controlling other things
 /// @param msg The CAN frame that was received by can.receive(). Need to convert from CANMessage to LV_CANMessage by copying address and byte.
-void LPDRV_RearLeft_CAN::receiveCANData(LV_CANMessage msg){
+void LPDRV_RearLeft_CAN::receiveCANData(const LV_CANMessage &msg){
     if(msg.addr == boardAddress){
         boardDetected = true;
-        bmsFaultInput = msg.byte0 & 1;  //Extract BMS fault from the first bit of byte 0
-        bmsFaultInput = msg.byte1 & 1;  //Extract BMS fault from the first bit of byte 1
+        receiveClock.stamp(msg);
+        Layout::unpack(msg, *this);
     }
 }
 
+/// @brief Registers this board's receiveCANData with a CAN_Dispatcher so frames on boardAddress are routed straight to it. Example: 'dispatcher.addBoard(lpdrv);'
+/// @param dispatcher The dispatcher to register with.
+/// @return False if the dispatcher is full or already routes boardAddress.
+bool LPDRV_RearLeft_CAN::registerReceive(CAN_Dispatcher &dispatcher){
+    return dispatcher.addHandler(boardAddress, &CAN_Dispatcher::memberHandler<LPDRV_RearLeft_CAN, &LPDRV_RearLeft_CAN::receiveCANData>, this);
+}
+
+
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////         POWER CONTROLLER FUNCTIONS        //////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/// Address, period in ms and template data bytes of every periodic frame sent to the Camry cluster, in CLUSTER_FRAME_* order. Bytes that depend on
+/// the class's fields are 0 here and patched in by buildFrame. See the spreadsheet linked in CamryCluster_CAN::sendCANData.
+static const struct{
+    uint16_t addr;
+    uint16_t periodMs;
+    uint8_t data[8];
+} clusterFrames[CLUSTER_FRAME_COUNT] = {
+    {PARKING_BRAKE_CAN_ADDR,    25,     {0x88, 0, 0, 0, 0, 0, 0, 0xC7}},
+    {SPEED_CAN_ADDR,            25,     {0, 0, 0, 0, 0, 0, 0, 0xBC}},
+    {FUEL_ECONOMY_CAN_ADDR,     25,     {0, 0, 0, 0, 0, 1, 0, 0}},
+    {ABS_CAN_ADDR,              250,    {0, 0, 0, 0, 0, 0, 0, 0x08}},
+    {POWER_STEER_CAN_ADDR,      250,    {0, 0, 0, 0, 0, 0, 0, 0}},
+    {PARK_ASSIST_CAN_ADDR,      250,    {0, 0, 0, 0, 0, 0, 0, 0}},
+    {MOTOR_SPOOF_CAN_ADDR,      250,    {0, 0, 0, 0, 0, 0, 0, 0}},
+    {TRANSMISSION_CAN_ADDR,     250,    {0, 0, 0, 0, 0, 0, 0, 0}},
+    {AIRBAG_CAN_ADDR,           1000,   {0, 0, 0, 0, 0, 0x08, 0, 0xC5}},
+    {LANE_DEPART_CAN_ADDR,      1000,   {0, 0, 0, 0, 0, 0, 0, 10}},
+    {PRECOLLISION_CAN_ADDR,     1000,   {0, 0, 0, 0, 0, 0, 0, 0}},
+    {PARKING_CAN_ADDR,          1000,   {1, 1, 1, 1, 0, 0, 0, 0}},
+    {LIGHTING_CAN_ADDR,         1000,   {0x12, 0, 0xE8, 0, 0, 0, 0, 0}},
+    {ENGINE_CONTROL_CAN_ADDR,   1000,   {0, 0, 0, 0, 0, 0, 0, 0}},
+    {SMART_KEY_CAN_ADDR,        1000,   {0x81, 0, 0, 0, 0, 0, 0, 0}},
+    {ANIMATIONS_CAN_ADDR,       1000,   {0x10, 0, 0, 0, 0, 0, 0x08, 0}},
+    {ENGINE_PROMPTS_CAN_ADDR,   1000,   {0, 0, 0, 0, 0, 0, 0, 0}},
+    {OUTDOOR_TEMP_CAN_ADDR,     1000,   {0, 0, 0, 0, 0, 0, 0, 0}},
+};
+
 /// @brief Initializes the control fields of the cluster to a default value. Must call sendCANData for the cluster to actually update.
 void CamryCluster_CAN::initialize(){
     brakeIcon = false;
@@ -258,17 +291,12 @@ void CamryCluster_CAN::initialize(){
     fogLightOrange = false;
     fogLightGreen = false;
     headlight = false;
-    last_headlight = !headlight;
     highbeam = false;
-    last_highbeam = !highbeam;
     driveMode = DRIVE_MODE_PARK;
     gearNumber = 0;
     sportMode = false;
     ecoMode = false;
     readyToDrive = false;
-    timer25ms = 0;
-    timer250ms = 0;
-    timer1000ms = 0;
     crashBrakePrompt = 0;
     clusterBeeps = BEEP_RATE_OFF;
     hudBlueLeftLane = false;
@@ -276,179 +304,252 @@ void CamryCluster_CAN::initialize(){
     hudLeftLaneColor = HUD_LANE_OFF;
     hudRightLaneColor = HUD_LANE_OFF;
     LCD_TakeBreak_Prompt = LCD_TAKE_BREAK_NONE;
-}
-
-void CamryCluster_CAN::send25msPackets(CAN_Controller &controller){
-    
-
-    //Periodically send out the rest of the 1000ms packets if no changes in value have occurred.
-    if(millis() - timer25ms < 25) return;       //If we haven't hit 25ms yet, don't send the packets
-    timer25ms = millis();                       //Reset the timer
-
-    uint16_t speedMask = speedGauge * 160;
-
-    static uint16_t speedFakeTimer = 0;
-    static bool everyOther = false;
-
-    if(everyOther){
-        speedFakeTimer += speedGauge * 0.56;   //33 = ~1 mile per minute (60mph)
-        everyOther = false;
+    speedFakeTimer = 0;
+    speedHalfPeriod = false;
+    indicatorState = ~packIndicatorState();     //Every instantly-sent frame counts as changed so the cluster is updated on the first sendCANData
+
+    //Periodic spoof frames. The scheduler staggers them so the ten 1000ms frames don't all go out in the same loop.
+    scheduler.clear();
+    for(uint8_t i = 0; i < CLUSTER_FRAME_COUNT; i++){
+        memcpy(&frameImage[i], clusterFrames[i].data, 8);
+        scheduler.addFrame(clusterFrames[i].addr, clusterFrames[i].periodMs, &CAN_PeriodicScheduler::memberBuilder<CamryCluster_CAN, &CamryCluster_CAN::buildFrame>, this);
     }
-    else{
-        everyOther = true;
-    } 
-
-    uint8_t economyBitmask = (uint8_t)((ecoGauge * 0x3C) / 100) & 0x3C;    //Calculate the economy bitmask based on the percentage of bars
-    economyBitmask = ecoLeaf ? economyBitmask + 0xC0 : economyBitmask;          //Eco leaf sets upper two bits
-
-    controller.CANSend(PARKING_BRAKE_CAN_ADDR, 0x88, parkingBrakeCircle ? 0x02 : 0x00, LCD_ParkingBrakePrompt, 0, 0, 0, 0, 0xC7);
-    controller.CANSend(SPEED_CAN_ADDR, 0, 0, 0, 0, speedFakeTimer & 255, speedMask >> 8, speedMask & 255, 0xBC);                           //Spoof for speedometer
-    if(driveMode != DRIVE_MODE_PARK) controller.CANSend(FUEL_ECONOMY_CAN_ADDR, 0, 0, 0, 0, 0, 1, economyBitmask, 0);                 //Spoof for fuel economy meter
-    //Update the last values for the next time we send out the 25ms packets
-    
+    staleImages = (1UL << CLUSTER_FRAME_COUNT) - 1;     //Patch every image on its first send
 }
 
-void CamryCluster_CAN::send250msPackets(CAN_Controller &controller){
+/// @brief [Internal Function] Replaces one data byte of a cached frame image.
+static inline void setImageByte(uint64_t &image, uint8_t byteIndex, uint8_t value){
+    image = (image & ~(0xFFULL << (byteIndex * 8))) | ((uint64_t)value << (byteIndex * 8));
+}
 
-    uint8_t powerSteerState = powerSteeringIcon ? 0x38:0x00;    //Clear steering wheel icon if no power steering error
+/// @brief [Internal Function] Records the fields a frame image depends on and reports whether the image needs patching.
+/// @param frame CLUSTER_FRAME_* index of the image.
+/// @param source The frame's fields packed into one word.
+/// @return True if source differs from when the image was last patched, or the image has never been patched.
+bool CamryCluster_CAN::imageSourceChanged(uint8_t frame, uint32_t source){
+    uint32_t bit = 1UL << frame;
+    if(source == frameSource[frame] && !(staleImages & bit)) return false;
+    frameSource[frame] = source;
+    staleImages &= ~bit;
+    return true;
+}
 
-    uint8_t otherGear = 0;                                      //Variable to check if in neutral or reverse, default to no gear
-    switch (driveMode){
-        case DRIVE_MODE_PARK:
-            otherGear = readyToDrive ? 0x20:0x00;
+/// @brief [Internal Function] Fills in the spoof frame for msg.addr from its cached image. Called by the scheduler each period, and by
+/// sendChangedPackets when a field changes. The image's variable bytes are only recalculated when the fields they come from have changed.
+/// @param msg Frame to fill in. msg.addr selects which spoof frame is built.
+/// @return False if the frame should not be sent this time.
+bool CamryCluster_CAN::buildFrame(LV_CANMessage &msg){
+    uint8_t frame;
+    switch(msg.addr){
+        case PARKING_BRAKE_CAN_ADDR:
+            frame = CLUSTER_FRAME_PARKING_BRAKE;
+            if(imageSourceChanged(frame, parkingBrakeCircle | (LCD_ParkingBrakePrompt << 8))){
+                setImageByte(frameImage[frame], 1, parkingBrakeCircle ? 0x02 : 0x00);
+                setImageByte(frameImage[frame], 2, LCD_ParkingBrakePrompt);
+            }
             break;
-        case DRIVE_MODE_REVERSE:
-            otherGear = 0x10;
+        case SPEED_CAN_ADDR:                                    //Spoof for speedometer
+            frame = CLUSTER_FRAME_SPEED;
+            if(speedHalfPeriod) speedFakeTimer += speedGauge * 56 / 100;    //33 = ~1 mile per minute (60mph)
+            speedHalfPeriod = !speedHalfPeriod;
+            setImageByte(frameImage[frame], 4, speedFakeTimer & 255);      //Changes every other send, always patched
+            if(imageSourceChanged(frame, speedGauge)){
+                uint16_t speedMask = speedGauge * 160;
+                setImageByte(frameImage[frame], 5, speedMask >> 8);
+                setImageByte(frameImage[frame], 6, speedMask & 255);
+            }
             break;
-        case DRIVE_MODE_SPORT:
-            otherGear = 0x09;
+        case FUEL_ECONOMY_CAN_ADDR:                             //Spoof for fuel economy meter
+            if(driveMode == DRIVE_MODE_PARK) return false;
+            frame = CLUSTER_FRAME_FUEL_ECONOMY;
+            if(imageSourceChanged(frame, ecoGauge | (ecoLeaf << 8))){
+                uint8_t economyBitmask = (uint8_t)((ecoGauge * 0x3C) / 100) & 0x3C;    //Calculate the economy bitmask based on the percentage of bars
+                economyBitmask = ecoLeaf ? economyBitmask + 0xC0 : economyBitmask;          //Eco leaf sets upper two bits
+                setImageByte(frameImage[frame], 6, economyBitmask);
+            }
             break;
-        case DRIVE_MODE_NEUTRAL:
-            otherGear = 0x08;
+        case ABS_CAN_ADDR:                                      //Spoof Anti-Lock brakes (All 0's clears errors)
+            frame = CLUSTER_FRAME_ABS;
+            if(imageSourceChanged(frame, brakeIcon)) setImageByte(frameImage[frame], 0, brakeIcon ? 0x40 : 0x00);
             break;
+        case POWER_STEER_CAN_ADDR:                              //Spoof for Power Steering, byte 1 controls steering wheel icon on cluster
+            frame = CLUSTER_FRAME_POWER_STEER;
+            if(imageSourceChanged(frame, powerSteeringIcon | (powerSteeringPrompt << 8))){
+                setImageByte(frameImage[frame], 1, powerSteeringIcon ? 0x38 : 0x00);
+                setImageByte(frameImage[frame], 2, powerSteeringPrompt);
+            }
+            break;
+        case PARK_ASSIST_CAN_ADDR:
+            frame = CLUSTER_FRAME_PARK_ASSIST;
+            break;
+        case MOTOR_SPOOF_CAN_ADDR:                              //Motor spoof for RPM dial
+            frame = CLUSTER_FRAME_MOTOR_SPOOF;
+            if(imageSourceChanged(frame, rpmGauge)){
+                setImageByte(frameImage[frame], 6, rpmGauge / 200);
+                setImageByte(frameImage[frame], 7, rpmGauge % 200);
+            }
+            break;
+        case TRANSMISSION_CAN_ADDR:                             //Transmission controller spoof, sets drive gear and sport/eco/normal modes
+            frame = CLUSTER_FRAME_TRANSMISSION;
+            if(imageSourceChanged(frame, driveMode | (readyToDrive << 8) | (gearNumber << 16) | (sportMode << 24) | (ecoMode << 25))){
+                uint8_t otherGear = 0;                          //Variable to check if in neutral or reverse, default to no gear
+                switch (driveMode){
+                    case DRIVE_MODE_PARK:
+                        otherGear = readyToDrive ? 0x20:0x00;
+                        break;
+                    case DRIVE_MODE_REVERSE:
+                        otherGear = 0x10;
+                        break;
+                    case DRIVE_MODE_SPORT:
+                        otherGear = 0x09;
+                        break;
+                    case DRIVE_MODE_NEUTRAL:
+                        otherGear = 0x08;
+                        break;
+                }
+
+                uint8_t driveSet = 0;                           //Drive setting variable, default of 0 (no gear)
+                if(driveMode != DRIVE_MODE_PARK && driveMode != DRIVE_MODE_REVERSE) driveSet = 0x80;           //If not in park mode, set this to 0x80
+
+                uint8_t driveModifier = 0;                      //Default normal drive mode (not eco or sport)
+                if(sportMode) driveModifier = 0x10;             //If bit 1 is set, then we are in sport mode (0x10 to instrument cluster signals sport)
+                if(ecoMode) driveModifier = 0x30;               //If bit 2 is set, then we are in eco mode (0x30 to instrument cluster signals eco)
+
+                setImageByte(frameImage[frame], 1, otherGear);
+                setImageByte(frameImage[frame], 4, gearNumber << 4);
+                setImageByte(frameImage[frame], 5, driveSet);
+                setImageByte(frameImage[frame], 7, driveModifier);
+            }
+            break;
+        case AIRBAG_CAN_ADDR:                                   //Spoof SRS Airbag system (All 0's clears errors)
+            frame = CLUSTER_FRAME_AIRBAG;
+            if(imageSourceChanged(frame, seatBeltIcon)) setImageByte(frameImage[frame], 3, seatBeltIcon ? 0x05:0x00);
+            break;
+        case LANE_DEPART_CAN_ADDR:                              //Lane departure spoof
+            frame = CLUSTER_FRAME_LANE_DEPART;
+            if(imageSourceChanged(frame, hudBlueLeftLane | ((uint32_t)hudBlueRightLane << 1) | ((uint32_t)hudLeftLaneColor << 8) | ((uint32_t)hudRightLaneColor << 16) | ((uint32_t)LCD_TakeBreak_Prompt << 24))){
+                uint8_t hudLaneMask = hudBlueLeftLane + (hudBlueRightLane << 1) + ((hudLeftLaneColor && 0x3) << 2) + ((hudRightLaneColor && 0x3) << 4);
+                setImageByte(frameImage[frame], 0, hudLaneMask);
+                setImageByte(frameImage[frame], 6, LCD_TakeBreak_Prompt);
+            }
+            break;
+        case PRECOLLISION_CAN_ADDR:                             //Precollision spoof
+            frame = CLUSTER_FRAME_PRECOLLISION;
+            if(imageSourceChanged(frame, crashBrakePrompt | ((uint32_t)clusterBeeps << 8))){
+                setImageByte(frameImage[frame], 0, crashBrakePrompt ? 0x10 : 0x00);
+                setImageByte(frameImage[frame], 3, clusterBeeps);
+            }
+            break;
+        case PARKING_CAN_ADDR:                                  //Parking sonar spoof
+            frame = CLUSTER_FRAME_PARKING;
+            break;
+        case LIGHTING_CAN_ADDR:                                 //Spoof for headlights/high beam system
+            frame = CLUSTER_FRAME_LIGHTING;
+            if(imageSourceChanged(frame, headlight | ((uint32_t)highbeam << 1))) setImageByte(frameImage[frame], 3, (headlight << 5) + (highbeam << 6));
+            break;
+        case ENGINE_CONTROL_CAN_ADDR:                           //Spoof for engine controller. Takes a flag that sets check engine, alternator failure and motor temperature
+            frame = CLUSTER_FRAME_ENGINE_CONTROL;
+            if(imageSourceChanged(frame, checkEngineOn | ((uint32_t)clusterBacklight << 1) | ((uint32_t)chargingSystemMalfunction << 2) | ((uint32_t)oilPressureLow << 3) | ((uint32_t)motorTempDegC << 16))){
+                uint8_t lowACC = 0;                             //Default to not a low accessory battery
+                if(chargingSystemMalfunction) lowACC = 0x04;    //If ACC battery is low, display prompt on LCD
+                else if(oilPressureLow) lowACC = 0x03;          //Show oil pressure low if battery is OK
+
+                uint8_t engineFault = checkEngineOn ? 0x00:0x40;                  //0x40 turns off check engine light from instrument cluster
+                if(!clusterBacklight) engineFault = checkEngineOn ? 0xB0:0xC0;    //Turn off backlight if needed
+
+                setImageByte(frameImage[frame], 0, engineFault);
+                setImageByte(frameImage[frame], 1, lowACC);
+                setImageByte(frameImage[frame], 2, (uint8_t)(motorTempDegC * 159 / 100 + 65));    //Dial position is 1.59 per degree C plus 65
+            }
+            break;
+        case SMART_KEY_CAN_ADDR:                                //Smart Key and Push to Start instructions
+            frame = CLUSTER_FRAME_SMART_KEY;
+            if(imageSourceChanged(frame, LCD_PowerPrompt)){
+                setImageByte(frameImage[frame], 6, LCD_PowerPrompt);
+                setImageByte(frameImage[frame], 7, LCD_PowerPrompt ? 0x0D:0);
+            }
+            break;
+        case ANIMATIONS_CAN_ADDR:                               //Spoof for instrument cluster animations and backlight dimming
+            frame = CLUSTER_FRAME_ANIMATIONS;
+            if(imageSourceChanged(frame, LCD_Brightness | ((uint32_t)animateStartup << 8) | ((uint32_t)trunkOpen << 9) | ((uint32_t)rearLeftDoor << 10) | ((uint32_t)rearRightDoor << 11) |
+                                         ((uint32_t)frontRightDoor << 12) | ((uint32_t)frontLeftDoor << 13) | ((uint32_t)seatBeltIcon << 14))){
+                uint8_t dashAnimationMask = animateStartup ? 0x00:0x40;
+                dashAnimationMask += trunkOpen + (rearLeftDoor << 2) + (rearRightDoor << 3) + (frontRightDoor << 4) + (frontLeftDoor << 5);
+                setImageByte(frameImage[frame], 4, LCD_Brightness);
+                setImageByte(frameImage[frame], 5, dashAnimationMask);
+                setImageByte(frameImage[frame], 7, seatBeltIcon ? 0x50:0x00);
+            }
+            break;
+        case ENGINE_PROMPTS_CAN_ADDR:
+            frame = CLUSTER_FRAME_ENGINE_PROMPTS;
+            if(imageSourceChanged(frame, LCD_EngineStoppedCode | ((uint32_t)LCD_CheckEnginePrompt << 8))){
+                setImageByte(frameImage[frame], 6, LCD_EngineStoppedCode);
+                setImageByte(frameImage[frame], 7, LCD_CheckEnginePrompt);
+            }
+            break;
+        case OUTDOOR_TEMP_CAN_ADDR:
+            frame = CLUSTER_FRAME_OUTDOOR_TEMP;
+            if(imageSourceChanged(frame, (uint32_t)outsideTemperatureF)){
+                //Temperature in C is sent as whole degrees + 48 and hundredths of a degree. Gets within +/- 1 degree on display.
+                int tempC5 = (outsideTemperatureF - 32) * 5;    //Nine times the temperature in C
+                setImageByte(frameImage[frame], 3, (uint8_t)(tempC5 / 9 + 48));
+                setImageByte(frameImage[frame], 5, (uint8_t)((tempC5 % 9) * 100 / 9));
+            }
+            break;
+        default:
+            return false;
     }
-
-    uint8_t driveSet = 0;                                       //Drive setting variable, default of 0 (no gear)
-    if(driveMode != DRIVE_MODE_PARK && driveMode != DRIVE_MODE_REVERSE) driveSet = 0x80;           //If not in park mode, set this to 0x80
-
-    uint8_t driveModifier = 0;                                  //Default normal drive mode (not eco or sport)      
-    if(sportMode) driveModifier = 0x10;                         //If bit 1 is set, then we are in sport mode (0x10 to instrument cluster signals sport)
-    if(ecoMode) driveModifier = 0x30;                           //If bit 2 is set, then we are in eco mode (0x30 to instrument cluster signals eco)
-
-    //Allow for instant update if values have changed for the BRAKE icon
-    static bool lastBrakeIcon;
-    if(brakeIcon != lastBrakeIcon){
-        controller.CANSend(ABS_CAN_ADDR, (brakeIcon ? 0x40:0x00), 0, 0, 0, 0, 0, 0, 0);                         //Spoof Anti-Lock brakes (All 0's clears errors)
-        lastBrakeIcon = brakeIcon;
-    }
-
-
-    //Periodically send out the rest of the 1000ms packets if no changes in value have occurred.
-    if(millis() - timer250ms < 250) return;     //If we haven't hit 250ms yet, don't send the packets
-    timer250ms = millis();                      //Reset the timer
-
-    controller.CANSend(ABS_CAN_ADDR, (brakeIcon ? 0x40:0x00), 0, 0, 0, 0, 0, 0, 0x08);                         //Spoof Anti-Lock brakes (All 0's clears errors)
-    controller.CANSend(POWER_STEER_CAN_ADDR, 0, powerSteerState, powerSteeringPrompt, 0, 0, 0, 0, 0);     //Spoof for Power Steering, byte 1 controls steering wheel icon on cluster
-    controller.CANSend(PARK_ASSIST_CAN_ADDR, 0, 0, 0, 0, 0, 0, 0, 0);
-    controller.CANSend(MOTOR_SPOOF_CAN_ADDR, 0, 0, 0, 0, 0, 0, rpmGauge/200, rpmGauge%200);                 //Motor spoof for RPM dial
-    controller.CANSend(TRANSMISSION_CAN_ADDR, 0, otherGear, 0, 0, (gearNumber << 4), driveSet, 0, driveModifier);           //Transmission controller spoof, sets drive gear and sport/eco/normal modes
-
-    //Update the last values for the next time we send out the 250ms packets
-    lastBrakeIcon = brakeIcon;
+    msg.setPayload(frameImage[frame]);
+    msg.len = 8;
+    return true;
 }
 
-void CamryCluster_CAN::send1000msPackets(CAN_Controller &controller){
-    
-    //Calculations for CAN Bus values based on the flags in the class
-    uint8_t lowACC = 0;                                         //Default to not a low accessory battery
-    if(chargingSystemMalfunction) lowACC = 0x04;                //If ACC battery is low, display prompt on LCD
-    else if(oilPressureLow) lowACC = 0x03;                      //Show oil pressure low if battery is OK
-
-    uint8_t engineFault = checkEngineOn ? 0x00:0x40;                  //0x40 turns off check engine light from instrument cluster
-    if(!clusterBacklight) engineFault = checkEngineOn ? 0xB0:0xC0;    //Turn off backlight if needed
-
-    uint8_t dashAnimationMask = animateStartup ? 0x00:0x40;
-    dashAnimationMask += trunkOpen + (rearLeftDoor << 2) + (rearRightDoor << 3) + (frontRightDoor << 4) + (frontLeftDoor << 5);
-
-    uint8_t precollisionMask = crashBrakePrompt ? 0x10 : 0x00;
-
-    uint8_t hudLaneMask = hudBlueLeftLane + (hudBlueRightLane << 1) + ((hudLeftLaneColor && 0x3) << 2) + ((hudRightLaneColor && 0x3) << 4);
+/// @brief [Internal Function] Packs every field that an instantly-sent frame depends on into one word, laid out as in the CLUSTER_STATE macros.
+uint64_t CamryCluster_CAN::packIndicatorState(){
+    return (uint64_t)brakeIcon | ((uint64_t)headlight << 1) | ((uint64_t)highbeam << 2) | ((uint64_t)seatBeltIcon << 3) |
+           ((uint64_t)checkEngineOn << 8) | ((uint64_t)clusterBacklight << 9) | ((uint64_t)chargingSystemMalfunction << 10) | ((uint64_t)oilPressureLow << 11) |
+           ((uint64_t)motorTempDegC << 16) | ((uint64_t)LCD_EngineStoppedCode << 32) | ((uint64_t)LCD_CheckEnginePrompt << 40);
+}
 
-    //Allow for instant update if values have changed for the headlight or highbeam
-    if(headlight != last_headlight || highbeam != last_highbeam){
-        controller.CANSend(LIGHTING_CAN_ADDR, 0x12, 0, 0xE8,(headlight << 5) + (highbeam << 6), 0, 0, 0, 0); //Send out spoof for headlights/high beam system when headlight switches have changed
-        last_headlight = headlight;
-        last_highbeam = highbeam;
+/// @brief [Internal Function] Sends the frames for indicators the driver notices right away (brake, seat belt, lights, engine) as soon as their
+/// fields change, instead of waiting up to a second for their next periodic send. When nothing changed this costs one compare.
+/// @param controller The CAN bus controller attached to this microcontroller.
+void CamryCluster_CAN::sendChangedPackets(CAN_Controller &controller){
+    uint64_t state = packIndicatorState();
+    uint64_t dirty = state ^ indicatorState;
+    if(dirty == 0) return;
+    indicatorState = state;
+
+    LV_CANMessage msg;
+    if(dirty & CLUSTER_STATE_ABS){
+        msg.addr = ABS_CAN_ADDR;
+        if(buildFrame(msg)) controller.CANSend(msg);
     }
-
-    //Allow for instant update if values have changed for the seatbelt icon
-    static bool lastSeatBeltIcon;
-    if(lastSeatBeltIcon != seatBeltIcon){
-        controller.CANSend(AIRBAG_CAN_ADDR, 0, 0, 0, (seatBeltIcon ? 0x05:0x00), 0, 0, 0, 0);                   //Spoof SRS Airbag system (All 0's clears errors)
-        lastSeatBeltIcon = seatBeltIcon;
+    if(dirty & CLUSTER_STATE_LIGHTING){
+        msg.addr = LIGHTING_CAN_ADDR;
+        if(buildFrame(msg)) controller.CANSend(msg);
     }
-
-    static uint8_t lastEngineFault;
-    static uint8_t lastLowACC;
-    static uint16_t lastMotorTemp;
-    if(lastEngineFault != engineFault || lastLowACC != lowACC || lastMotorTemp != motorTempDegC){
-        controller.CANSend(ENGINE_CONTROL_CAN_ADDR, engineFault,lowACC,(motorTempDegC*1.59)+65,0,0,0,0,0);      //Spoof for engine controller. Takes a flag that sets check engine, alternator failure and motor temperature
-        lastEngineFault = engineFault;
-        lastLowACC = lowACC;
-        lastMotorTemp = motorTempDegC;
+    if(dirty & CLUSTER_STATE_AIRBAG){
+        msg.addr = AIRBAG_CAN_ADDR;
+        if(buildFrame(msg)) controller.CANSend(msg);
     }
-
-    static uint8_t lastEngineStoppedCode;
-    static uint8_t lastCheckEnginePrompt;
-    if(lastEngineStoppedCode != LCD_EngineStoppedCode || lastCheckEnginePrompt != LCD_CheckEnginePrompt){
-        controller.CANSend(ENGINE_PROMPTS_CAN_ADDR, 0, 0 , 0, 0, 0, 0, LCD_EngineStoppedCode, LCD_CheckEnginePrompt);
-        lastEngineStoppedCode = LCD_EngineStoppedCode;
-        lastCheckEnginePrompt = LCD_CheckEnginePrompt;
+    if(dirty & CLUSTER_STATE_ENGINE_CONTROL){
+        msg.addr = ENGINE_CONTROL_CAN_ADDR;
+        if(buildFrame(msg)) controller.CANSend(msg);
+    }
+    if(dirty & CLUSTER_STATE_ENGINE_PROMPTS){
+        msg.addr = ENGINE_PROMPTS_CAN_ADDR;
+        if(buildFrame(msg)) controller.CANSend(msg);
     }
-    
-    //Sort-of approximation for temperature. Gets within +/- 1 degree on display.
-    float tempC = ((double)(outsideTemperatureF - 32) * 5.0) / 9.0;
-    float temperatureMaskUpper;
-    float temperatureMaskLower = std::modf(tempC, &temperatureMaskUpper);
-    temperatureMaskLower = temperatureMaskLower * 100;
-    temperatureMaskUpper += 48;
-
-
-    //Periodically send out the rest of the 1000ms packets if no changes in value have occurred.
-    if(millis() - timer1000ms < 1000) return;   //If we haven't hit 1000ms yet, don't send the packets
-    timer1000ms = millis();                     //Reset the timer
-
-    controller.CANSend(AIRBAG_CAN_ADDR, 0, 0, 0, (seatBeltIcon ? 0x05:0x00), 0, 0x08, 0, 0xC5);             //Spoof SRS Airbag system (All 0's clears errors)
-    controller.CANSend(LANE_DEPART_CAN_ADDR, hudLaneMask, 0, 0, 0, 0, 0, LCD_TakeBreak_Prompt, 10);          //Lane departure spoof
-    controller.CANSend(PRECOLLISION_CAN_ADDR, precollisionMask, 0, 0, clusterBeeps, 0, 0, 0, 0);            //Precollision spoof
-    controller.CANSend(PARKING_CAN_ADDR, 1, 1, 1, 1, 0, 0, 0, 0);                                           //Parking sonar spoof
-    controller.CANSend(LIGHTING_CAN_ADDR, 0x12, 0, 0xE8,(headlight << 5) + (highbeam << 6), 0, 0, 0, 0);    //Send out spoof for headlights/high beam system when headlight switches have changed
-    controller.CANSend(ENGINE_CONTROL_CAN_ADDR, engineFault,lowACC,(motorTempDegC*1.59)+65,0,0,0,0,0);      //Spoof for engine controller. Takes a flag that sets check engine, alternator failure and motor temperature
-    controller.CANSend(SMART_KEY_CAN_ADDR, 0x81, 0, 0, 0, 0, 0, LCD_PowerPrompt, LCD_PowerPrompt ? 0x0D:0); //Smart Key and Push to Start instructions
-    controller.CANSend(ANIMATIONS_CAN_ADDR, 0x10, 0, 0, 0, LCD_Brightness, dashAnimationMask, 0x08, seatBeltIcon ? 0x50:0x00);    //Spoof for instrument cluster animations and backlight dimming
-    controller.CANSend(ENGINE_PROMPTS_CAN_ADDR, 0, 0 , 0, 0, 0, 0, LCD_EngineStoppedCode, LCD_CheckEnginePrompt);
-    controller.CANSend(OUTDOOR_TEMP_CAN_ADDR, 0, 0, 0, (uint8_t)temperatureMaskUpper, 0, (uint8_t)temperatureMaskLower, 0, 0);
-
-    //Update the last values for the next time we send out the 1000ms packets
-    last_headlight = headlight;
-    last_highbeam = highbeam;
-    lastEngineFault = engineFault;
-    lastLowACC = lowACC;
-    lastMotorTemp = motorTempDegC;
-    lastEngineStoppedCode = LCD_EngineStoppedCode;
-    lastCheckEnginePrompt = LCD_CheckEnginePrompt;
-
 }
 
 /// @brief Taskes the locally populated fields and generates the CAN bus frames needed to spoof the Camry Cluster components.
 /// @param controller The CAN bus controller attached to this microcontroller.
 void CamryCluster_CAN::sendCANData(CAN_Controller &controller){
     //SEE THIS SHEET FOR HOW THE SPOOF WORKS: https://docs.google.com/spreadsheets/d/1bL61UoguuONFQnytRpy7xj2nyJdYXmgT9HQCQns6Ij0/edit?usp=sharing
-    
-    send25msPackets(controller);
-    send250msPackets(controller);
-    send1000msPackets(controller);
-
+    if(!controller.busHealthy()) return;    //Spoof frames are cosmetic, give the bus to the safety frames until it recovers
+    sendChangedPackets(controller);
+    scheduler.service(controller);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -507,55 +608,1253 @@ unsigned long convertBaudRateToMCP(unsigned long baudRate){
     return baudRate;            //If baudRate <= CAN_1000KBPS, then assumes we're already in MCP format
 }
 
+/// @brief Checks whether a board should send msg now: always with no heartbeat set, otherwise when the data or length changed since the last frame
+/// sent or heartbeatMs has passed. When it returns true, msg is remembered as the last frame sent.
+/// @param msg The frame sendCANData has just encoded.
+/// @return True if the frame should be sent.
+bool CAN_SendPolicy::shouldSend(const LV_CANMessage &msg){
+    uint32_t now = millis();
+    uint64_t payload = msg.payload();
+    if(heartbeatMs != CAN_SEND_EVERY_CALL && lastValid && payload == lastPayload && msg.len == lastLen && now - lastSendMillis < heartbeatMs){
+        skipped++;
+        return false;
+    }
+    lastPayload = payload;
+    lastLen = msg.len;
+    lastValid = true;
+    lastSendMillis = now;
+    return true;
+}
+
+/// @brief Forgets the last frame sent, so the next shouldSend() returns true. Call when the frame shouldSend allowed never made it out.
+void CAN_SendPolicy::sendFailed(){
+    lastValid = false;
+}
+
+/// @brief Returns the number of shouldSend() calls that skipped a frame because nothing had changed.
+uint32_t CAN_SendPolicy::skippedCount(){
+    return skipped;
+}
+
 //Update function which allows new data values to be passed in all at once
 void LV_CANMessage::update(uint32_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7){
     addr = Can_addr;
     byte0 = data0; byte1 = data1; byte2 = data2; byte3 = data3; byte4 = data4; byte5 = data5; byte6 = data6; byte7 = data7;
+    len = 8;
+    extended = Can_addr > 0x7FF;    //Anything that doesn't fit in 11 bits has to go out as an extended ID
+}
+
+static_assert(offsetof(LV_CANMessage, byte7) - offsetof(LV_CANMessage, byte0) == 7, "LV_CANMessage::data() needs byte0-byte7 to be contiguous");
+
+static_assert((CAN_RX_RING_SIZE & (CAN_RX_RING_SIZE - 1)) == 0, "CAN_RX_RING_SIZE must be a power of two");
+
+/// @brief [Producer] Copies a frame into the ring. Only call this from one context (the MCP2515 interrupt).
+/// @param msg The frame to store.
+/// @return True if the frame was stored, false if the ring was full and the frame was dropped.
+bool LV_CANRingBuffer::push(const LV_CANMessage &msg){
+    uint16_t h = head.load(std::memory_order_relaxed);
+    uint16_t t = tail.load(std::memory_order_acquire);
+    if((uint16_t)(h - t) >= CAN_RX_RING_SIZE){     //Consumer hasn't caught up, drop the newest frame
+        overflows = overflows + 1;
+        return false;
+    }
+    slots[h & (CAN_RX_RING_SIZE - 1)] = msg;
+    head.store(h + 1, std::memory_order_release);   //Publish the slot only after it has been written
+    return true;
+}
+
+/// @brief [Consumer] Takes the oldest frame out of the ring. Only call this from one context (the main loop).
+/// @param msg Populated with the oldest frame (returns reference).
+/// @return True if a frame was returned, false if the ring was empty.
+bool LV_CANRingBuffer::pop(LV_CANMessage &msg){
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    uint16_t h = head.load(std::memory_order_acquire);
+    if(h == t) return false;
+    msg = slots[t & (CAN_RX_RING_SIZE - 1)];
+    tail.store(t + 1, std::memory_order_release);   //Hand the slot back to the producer
+    return true;
+}
+
+/// @brief [Producer] Returns the next free slot so the frame can be read straight into the ring. Nothing is visible to the consumer until commit().
+/// @return Pointer to the slot, or NULL if the ring is full.
+LV_CANMessage *LV_CANRingBuffer::reserve(){
+    uint16_t h = head.load(std::memory_order_relaxed);
+    uint16_t t = tail.load(std::memory_order_acquire);
+    if((uint16_t)(h - t) >= CAN_RX_RING_SIZE) return NULL;
+    return &slots[h & (CAN_RX_RING_SIZE - 1)];
+}
+
+/// @brief [Producer] Publishes the slot returned by reserve() to the consumer.
+void LV_CANRingBuffer::commit(){
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/// @brief [Consumer] Returns the oldest frame without copying it out of the ring. The slot stays valid until release().
+/// @return Pointer to the frame, or NULL if the ring is empty.
+const LV_CANMessage *LV_CANRingBuffer::peek(){
+    uint16_t t = tail.load(std::memory_order_relaxed);
+    uint16_t h = head.load(std::memory_order_acquire);
+    if(h == t) return NULL;
+    return &slots[t & (CAN_RX_RING_SIZE - 1)];
+}
+
+/// @brief [Consumer] Frees the slot returned by peek() for the producer.
+void LV_CANRingBuffer::release(){
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/// @brief Returns the number of frames waiting in the ring.
+uint16_t LV_CANRingBuffer::count(){
+    return (uint16_t)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+}
+
+/// @brief Returns the number of frames dropped because the ring was full.
+uint32_t LV_CANRingBuffer::overflowCount(){
+    return overflows;
+}
+
+/// @brief Empties the ring and resets the overflow counter. Only call this while the producer is stopped.
+void LV_CANRingBuffer::clear(){
+    head.store(0);
+    tail.store(0);
+    overflows = 0;
+}
+
+/// @brief [Internal Function] Returns a value that sorts frames the way the bus arbitrates them: lower wins. The 11 bits of a standard ID line up with
+/// the top 11 bits of an extended ID.
+static uint32_t canArbitrationKey(const LV_CANMessage &msg){
+    return msg.extended ? (msg.addr & 0x1FFFFFFF) : ((msg.addr & 0x7FF) << 18);
+}
+
+/// @brief Inserts a frame behind every queued frame of equal or higher priority. If the queue is full, the lowest priority frame is evicted when msg outranks it.
+/// @param msg The frame to queue.
+/// @return True if msg was queued, false if it was dropped.
+bool LV_CANTxQueue::push(const LV_CANMessage &msg){
+    uint32_t key = canArbitrationKey(msg);
+    if(frameCount == CAN_TX_QUEUE_SIZE){
+        dropped++;
+        if(key >= canArbitrationKey(frames[0])) return false;          //Everything queued outranks this frame
+        memmove(&frames[0], &frames[1], (frameCount - 1) * sizeof(LV_CANMessage));    //Evict the lowest priority frame
+        frameCount--;
+    }
+    uint8_t pos = 0;
+    while(pos < frameCount && canArbitrationKey(frames[pos]) > key) pos++;     //Skip past lower priority frames, stop in front of equal ones so they go out first
+    memmove(&frames[pos + 1], &frames[pos], (frameCount - pos) * sizeof(LV_CANMessage));
+    frames[pos] = msg;
+    frameCount++;
+    return true;
+}
+
+/// @brief Copies the highest priority frame without removing it from the queue.
+/// @param msg Populated with the next frame to send (returns reference).
+/// @return False if the queue is empty.
+bool LV_CANTxQueue::peek(LV_CANMessage &msg){
+    if(frameCount == 0) return false;
+    msg = frames[frameCount - 1];
+    return true;
+}
+
+/// @brief Removes the highest priority frame from the queue.
+/// @param msg Populated with the next frame to send (returns reference).
+/// @return False if the queue is empty.
+bool LV_CANTxQueue::pop(LV_CANMessage &msg){
+    if(frameCount == 0) return false;
+    msg = frames[--frameCount];
+    return true;
+}
+
+/// @brief Returns the number of frames waiting in the queue.
+uint8_t LV_CANTxQueue::count(){
+    return frameCount;
+}
+
+/// @brief Returns the number of frames dropped or evicted because the queue was full.
+uint32_t LV_CANTxQueue::droppedCount(){
+    return dropped;
+}
+
+/// @brief Drops every queued frame that would lose arbitration to addr. Used to clear out low priority traffic when the bus goes bad.
+/// @param addr Standard ID of the lowest priority frame to keep.
+/// @return Number of frames removed.
+uint8_t LV_CANTxQueue::removeBelowPriority(uint32_t addr){
+    LV_CANMessage limit;
+    limit.update(addr, 0, 0, 0, 0, 0, 0, 0, 0);
+    uint32_t limitKey = canArbitrationKey(limit);
+    uint8_t removed = 0;
+    while(removed < frameCount && canArbitrationKey(frames[removed]) > limitKey) removed++;   //Lowest priority frames sit at the front
+    memmove(&frames[0], &frames[removed], (frameCount - removed) * sizeof(LV_CANMessage));
+    frameCount -= removed;
+    return removed;
+}
+
+/// @brief Empties the queue and resets the dropped counter.
+void LV_CANTxQueue::clear(){
+    frameCount = 0;
+    dropped = 0;
+}
+
+/// @brief Manually sends a CAN bus packet using the CAN bus controller on the address specified with the inputted data. Example: 'CANSend(0x100, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08);' transmits on address 0x100 with the data [1,2,3,4,5,6,7,8]
+/// @param Can_addr CAN Bus address to transmit on
+/// @param data0 CAN Bus Data 0 field (8 bits)
+/// @param data1 CAN Bus Data 1 field (8 bits)
+/// @param data2 CAN Bus Data 2 field (8 bits)
+/// @param data3 CAN Bus Data 3 field (8 bits)
+/// @param data4 CAN Bus Data 4 field (8 bits)
+/// @param data5 CAN Bus Data 5 field (8 bits)
+/// @param data6 CAN Bus Data 6 field (8 bits)
+/// @param data7 CAN Bus Data 7 field (8 bits)
+/// @return CAN_TX_SENT, CAN_TX_QUEUED or CAN_TX_DROPPED. Never blocks waiting for the bus.
+uint8_t CAN_Controller::CANSend(uint32_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7){
+    LV_CANMessage txMessage;
+    txMessage.update(Can_addr, data0, data1, data2, data3, data4, data5, data6, data7);
+    return CANSend(txMessage);
+}
+
+/// @brief Sends a CAN bus packet with only as many data bytes as needed. Shorter messages take less time on the bus. Example: 'byte tx[2] = {0x01, 0x02}; CANSend(0x100, tx, 2);'
+/// @param Can_addr CAN Bus address to transmit on. Addresses above 0x7FF are sent as 29-bit extended IDs.
+/// @param data Data bytes to send.
+/// @param len Number of bytes in data (0-8).
+/// @return CAN_TX_SENT, CAN_TX_QUEUED or CAN_TX_DROPPED. Never blocks waiting for the bus.
+uint8_t CAN_Controller::CANSend(uint32_t Can_addr, const uint8_t *data, uint8_t len){
+    uint8_t padded[8] = {0};
+    if(len > 8) len = 8;
+    memcpy(padded, data, len);
+    LV_CANMessage txMessage;
+    txMessage.update(Can_addr, padded[0], padded[1], padded[2], padded[3], padded[4], padded[5], padded[6], padded[7]);
+    txMessage.len = len;
+    return CANSend(txMessage);
+}
+
+/// @brief [Internal Function] Stamps a frame with the current time and keeps it in the transmit history for lastTransmitted().
+void CAN_Controller::recordTxComplete(const LV_CANMessage &msg){
+    LV_CANMessage &entry = txHistory[txHistoryNext];
+    entry = msg;
+    entry.txTimestampUs = micros();
+    txHistoryNext = (txHistoryNext + 1) % CAN_TX_HISTORY_SIZE;
+}
+
+/// @brief Finds the most recently sent frame on a CAN address. Use msg.txTimestampUs to measure when it actually went out.
+/// @param addr CAN address to look up.
+/// @param msg Populated with the sent frame and its txTimestampUs (returns reference).
+/// @return False if no frame on addr is in the last CAN_TX_HISTORY_SIZE sent frames.
+bool CAN_Controller::lastTransmitted(uint32_t addr, LV_CANMessage &msg){
+    for(uint8_t i = 1; i <= CAN_TX_HISTORY_SIZE; i++){        //Newest first
+        const LV_CANMessage &entry = txHistory[(txHistoryNext + CAN_TX_HISTORY_SIZE - i) % CAN_TX_HISTORY_SIZE];
+        if(entry.txTimestampUs != 0 && entry.addr == addr){
+            msg = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Returns the number of frames waiting in the transmit queue for the hardware to have room.
+uint8_t CAN_Controller::txQueueDepth(){
+    return txQueue.count();
+}
+
+/// @brief Returns the number of frames dropped because the transmit queue was full of higher priority frames.
+uint32_t CAN_Controller::txDroppedCount(){
+    return txQueue.droppedCount();
+}
+
+/// @brief [Internal Function] Returns the number of bits a data frame takes on the bus, including the interframe space and worst-case bit stuffing.
+static uint16_t canFrameBits(uint8_t len, bool extended){
+    uint16_t stuffable = (extended ? 54 : 34) + 8 * len;   //SOF through CRC is subject to stuffing
+    return stuffable + (stuffable - 1) / 4 + 13;            //CRC delimiter, ACK, EOF and IFS are fixed form
+}
+
+/// @brief [Internal Function] Clears the traffic counters and error state history reported by busStats().
+void CAN_Controller::resetBusStats(){
+    txFrameCount = 0;
+    rxFrameCount = 0;
+    txByteCount = 0;
+    rxByteCount = 0;
+    busBitCount = 0;
+    lastStatsMillis = millis();
+    lastErrorState = CAN_STATE_ERROR_ACTIVE;
+    busOffEvents = 0;
+    errorPassiveEvents = 0;
+    healthy = true;
+    txHeld = false;
+    currentBackoffMs = recoveryPolicy.initialBackoffMs;
+    healthySinceMillis = lastStatsMillis;
+    lastHealthCheckMillis = lastStatsMillis;
+}
+
+/// @brief [Internal Function] Adds a frame to the traffic counters. Called when a frame is handed to or read out of the hardware.
+void CAN_Controller::recordFrame(bool transmitted, uint8_t len, bool extended){
+    if(transmitted){
+        txFrameCount++;
+        txByteCount += len;
+    }
+    else{
+        rxFrameCount++;
+        rxByteCount += len;
+    }
+    busBitCount += canFrameBits(len, extended);
+}
+
+/// @brief [Internal Function] Hands out the frame peekReceive() is holding in peekSlot, so receive() and receiveBatch() return it before any newer frame.
+/// @return True if a held frame was copied into msg.
+bool CAN_Controller::takePeekedFrame(LV_CANMessage &msg){
+    if(!peekValid) return false;
+    msg = peekSlot;
+    peekValid = false;
+    return true;
+}
+
+/// @brief Samples the traffic counters, bus load and error counters of the CAN controller. Example: 'CAN_BusStats stats = controller.busStats();'
+/// @return Traffic since begin(), bus load since the previous call to busStats(), and the current error state.
+CAN_BusStats CAN_Controller::busStats(){
+    CAN_BusStats stats;
+    uint32_t now = millis();
+    uint32_t elapsed = now - lastStatsMillis;
+    stats.txFrames = txFrameCount;
+    stats.rxFrames = rxFrameCount;
+    stats.txBytes = txByteCount;
+    stats.rxBytes = rxByteCount;
+    uint32_t bitsPerSecond = convertBaudRateToParticle(currentBaudRate);
+    stats.busLoadPercent = (elapsed && bitsPerSecond) ? 100000.0f * busBitCount / ((float)bitsPerSecond * elapsed) : 0;
+    if(stats.busLoadPercent > 100) stats.busLoadPercent = 100;
+    busBitCount = 0;
+    lastStatsMillis = now;
+    sampleErrorCounters(stats);
+    noteErrorState(stats.errorState);
+    stats.busOffEvents = busOffEvents;
+    stats.errorPassiveEvents = errorPassiveEvents;
+    stats.droppedFrames = txQueue.droppedCount();
+    #if PLATFORM_ID != PLATFORM_PHOTON_PRODUCTION
+    stats.droppedFrames += rxRing.overflowCount();
+    #endif
+    return stats;
+}
+
+/// @brief [Internal Function] Tracks changes in the controller's error state: counts events, marks the bus unhealthy, and on bus-off holds all
+/// transmission for the current backoff time. Takes the SPI bus itself to purge the queue, so it must not be called while the bus is held.
+void CAN_Controller::noteErrorState(uint8_t state){
+    uint32_t now = millis();
+    if(state != CAN_STATE_ERROR_ACTIVE) healthy = false;
+    if(state == lastErrorState) return;
+    if(state == CAN_STATE_BUS_OFF){
+        busOffEvents++;
+        txHeld = true;                                      //Stop feeding a controller that can't transmit
+        backoffStartMillis = now;
+    }
+    else if(state == CAN_STATE_ERROR_PASSIVE && lastErrorState == CAN_STATE_ERROR_ACTIVE) errorPassiveEvents++;
+    if(state != CAN_STATE_ERROR_ACTIVE){
+        #if PLATFORM_ID != PLATFORM_PHOTON_PRODUCTION
+        lockSPI();                                          //The TX-complete interrupt pops from txQueue, keep it out while the queue is compacted
+        #endif
+        txQueue.removeBelowPriority(recoveryPolicy.suppressAboveId);   //Make room for the frames that matter
+        #if PLATFORM_ID != PLATFORM_PHOTON_PRODUCTION
+        unlockSPI();
+        #endif
+    }
+    else healthySinceMillis = now;
+    lastErrorState = state;
+}
+
+/// @brief [Internal Function] Checks the controller's error state every CAN_HEALTH_CHECK_MS and runs the bus-off recovery: once the backoff expires
+/// the controller is restarted and the next backoff doubles, until the bus has stayed error-active for healthyHoldMs.
+void CAN_Controller::updateBusHealth(){
+    uint32_t now = millis();
+    if(txHeld){
+        if(now - backoffStartMillis < currentBackoffMs) return;
+        restartController();
+        txHeld = false;
+        lastErrorState = CAN_STATE_ERROR_ACTIVE;            //Restart clears the error counters
+        healthySinceMillis = now;
+        currentBackoffMs = currentBackoffMs * 2 > recoveryPolicy.maxBackoffMs ? recoveryPolicy.maxBackoffMs : currentBackoffMs * 2;
+        lastHealthCheckMillis = now;
+        return;
+    }
+    if(now - lastHealthCheckMillis < CAN_HEALTH_CHECK_MS) return;
+    lastHealthCheckMillis = now;
+    CAN_BusStats sample;
+    sampleErrorCounters(sample);
+    noteErrorState(sample.errorState);
+    if(!healthy && sample.errorState == CAN_STATE_ERROR_ACTIVE && now - healthySinceMillis >= recoveryPolicy.healthyHoldMs){
+        healthy = true;
+        currentBackoffMs = recoveryPolicy.initialBackoffMs;
+    }
+}
+
+/// @brief Changes how the controller recovers from bus-off and which frames are held back while the bus is unhealthy.
+/// Example: 'CAN_RecoveryPolicy policy; policy.suppressAboveId = 0x130; controller.setRecoveryPolicy(policy);'
+/// @param policy Backoff times and the lowest priority ID still sent while the bus is unhealthy.
+void CAN_Controller::setRecoveryPolicy(const CAN_RecoveryPolicy &policy){
+    recoveryPolicy = policy;
+    if(healthy) currentBackoffMs = policy.initialBackoffMs;
+}
+
+/// @brief Returns false while the controller is error-passive, bus-off, or hasn't yet been error-active for healthyHoldMs. Low priority periodic
+/// traffic should be skipped while this is false.
+bool CAN_Controller::busHealthy(){
+    updateBusHealth();
+    return healthy;
+}
+
+/// @brief Packs the stats into an LV_CANMessage so a board can report its bus health on the LV CAN bus. Example: 'controller.busStats().encode(0x7F0, msg); controller.CANSend(msg);'
+/// Byte 0 is bus load in 0.5% steps, bytes 1-2 are TEC and REC, byte 3 is errorState, bytes 4-5 are bus-off and error-passive event counts
+/// (capped at 255), and bytes 6-7 are dropped frames (big endian, capped at 65535).
+/// @param Can_addr CAN Bus address to send the stats on.
+/// @param msg Message to populate (returns reference).
+void CAN_BusStats::encode(uint32_t Can_addr, LV_CANMessage &msg){
+    uint16_t dropped = droppedFrames > 0xFFFF ? 0xFFFF : droppedFrames;
+    msg.update(Can_addr,
+        (uint8_t)(busLoadPercent * 2), txErrorCount, rxErrorCount, errorState,
+        busOffEvents > 0xFF ? 0xFF : busOffEvents, errorPassiveEvents > 0xFF ? 0xFF : errorPassiveEvents,
+        (uint8_t)(dropped >> 8), (uint8_t)(dropped & 0xFF));
+}
+
+/// @brief Starts a transmit burst. Frames passed to CANSend are held in the transmit queue until the matching endTxBurst(), then loaded into the
+/// hardware together so a board's group of frames goes out back to back. Example: 'controller.beginTxBurst(); controller.CANSend(a); controller.CANSend(b); controller.endTxBurst();'
+void CAN_Controller::beginTxBurst(){
+    txBurstDepth++;
+}
+
+/// @brief Ends a transmit burst started with beginTxBurst() and loads the held frames into the hardware.
+void CAN_Controller::endTxBurst(){
+    if(txBurstDepth == 0) return;
+    if(--txBurstDepth == 0) serviceTx();
+}
+
+//Rates tried by autoDetectBaud, most likely first
+static const uint32_t canAutoBaudRates[] = {500000, 250000, 1000000, 125000, 100000, 50000, 200000};
+
+/// @brief Finds the bus speed by listening at each supported rate in turn and counting valid frames against bus errors. Locks onto the first rate
+/// that receives minFrames frames with no errors; if none does, takes the rate with the most frames over errors. Takes at most
+/// listenMs times the number of rates (7). On the MCP2515 the chip is in listen-only mode while searching, so it never acknowledges frames or sends
+/// error frames. The Photon's CAN peripheral has no silent mode, so at a wrong rate it can put error frames on the bus while searching.
+/// Frames already in the transmit queue are sent once the search finishes. Example: 'canController.begin(500000, A2); canController.autoDetectBaud();'
+/// @param listenMs Longest time to listen at each rate, in milliseconds. Must be longer than the slowest message period expected on the bus.
+/// @param minFrames Number of error-free frames needed to lock onto a rate early.
+/// @return The detected speed in bps, running in normal mode. Returns 0 and goes back to the previous speed if no frames were seen at any rate.
+uint32_t CAN_Controller::autoDetectBaud(uint16_t listenMs, uint8_t minFrames){
+    uint32_t previousRate = convertBaudRateToParticle(currentBaudRate);
+    uint32_t bestRate = 0;
+    int32_t bestScore = 0;
+    #if PLATFORM_ID != PLATFORM_PHOTON_PRODUCTION
+    bool useInterrupt = interruptEnabled;
+    interruptEnabled = false;                           //Leave frames in the MCP2515 for listenForFrames instead of the receive ring
+    #endif
+    for(uint8_t r = 0; r < sizeof(canAutoBaudRates) / sizeof(canAutoBaudRates[0]); r++){
+        uint16_t frames = 0;
+        uint16_t errors = 0;
+        startListening(canAutoBaudRates[r]);
+        uint32_t start = millis();
+        while(millis() - start < listenMs){
+            listenForFrames(frames, errors);
+            if(frames >= minFrames && errors == 0) break;
+        }
+        if(frames >= minFrames && errors == 0){
+            bestRate = canAutoBaudRates[r];
+            break;
+        }
+        int32_t score = (int32_t)frames - errors;
+        if(score > bestScore){
+            bestScore = score;
+            bestRate = canAutoBaudRates[r];
+        }
+    }
+    #if PLATFORM_ID != PLATFORM_PHOTON_PRODUCTION
+    interruptEnabled = useInterrupt;
+    #endif
+    changeCANSpeed(bestRate != 0 ? bestRate : previousRate);
+    resetBusStats();                                    //Frames and errors seen while searching don't belong in the bus statistics
+    serviceTx();
+    return bestRate;
+}
+
+/// @brief [Internal Function] A set of standard IDs that one hardware filter can accept: every ID x where (x & mask) == value.
+struct CANFilterCube{
+    uint16_t value;
+    uint16_t mask;
+};
+
+/// @brief [Internal Function] Returns the smallest cube holding both a and b. Only bits where both cubes agree stay in the mask.
+static CANFilterCube mergeFilterCubes(CANFilterCube a, CANFilterCube b){
+    CANFilterCube merged;
+    merged.mask = a.mask & b.mask & ~(a.value ^ b.value) & 0x7FF;
+    merged.value = a.value & merged.mask;
+    return merged;
+}
+
+/// @brief [Internal Function] Returns the number of standard IDs accepted by a cube.
+static uint16_t filterCubeSize(CANFilterCube cube){
+    return 1 << (11 - __builtin_popcount(cube.mask & 0x7FF));
+}
+
+/// @brief [Internal Function] Returns true if every ID in inner is also in outer.
+static bool filterCubeContains(CANFilterCube outer, CANFilterCube inner){
+    return (inner.mask & outer.mask) == outer.mask && (inner.value & outer.mask) == outer.value;
+}
+
+/// @brief [Internal Function] Finds the IDs accepted by both a and b. Returns false if no ID is in both.
+static bool intersectFilterCubes(CANFilterCube a, CANFilterCube b, CANFilterCube &overlap){
+    if((a.value ^ b.value) & a.mask & b.mask) return false;    //They disagree on a bit both care about
+    overlap.mask = (a.mask | b.mask) & 0x7FF;
+    overlap.value = (a.value | b.value) & overlap.mask;
+    return true;
+}
+
+/// @brief [Internal Function] Counts the IDs in cube that none of the first count cubes of others accept, by splitting off the overlap with each
+/// overlapping cube in turn (inclusion-exclusion). A cube inside one of the others ends the branch at once, so real plans only take a few steps.
+static uint16_t countUncoveredIds(CANFilterCube cube, const CANFilterCube *others, uint8_t count){
+    while(count > 0){
+        count--;
+        if(filterCubeContains(others[count], cube)) return 0;
+        CANFilterCube overlap;
+        if(!intersectFilterCubes(cube, others[count], overlap)) continue;
+        return countUncoveredIds(cube, others, count) - countUncoveredIds(overlap, others, count);
+    }
+    return filterCubeSize(cube);
+}
+
+/// @brief [Internal Function] Counts exactly how many of the 2048 standard IDs pass at least one filter of the plan, from the filters' masks
+/// instead of trying every ID.
+static uint16_t countHardwareAccepts(const CAN_FilterPlan &plan){
+    CANFilterCube cubes[CAN_MAX_HW_FILTERS];
+    uint16_t accepted = 0;
+    for(uint8_t f = 0; f < plan.filterCount; f++){
+        cubes[f].mask = plan.filterMasks[f] & 0x7FF;
+        cubes[f].value = plan.filterIds[f] & cubes[f].mask;
+        accepted += countUncoveredIds(cubes[f], cubes, f);     //Only the IDs the earlier filters didn't already accept
+    }
+    return accepted;
+}
+
+/// @brief [Internal Function] Fills in the filters for one way of loading the cubes into the hardware and scores it. On the MCP2515, the cubes
+/// selected by bankA share RXM0 (filters 0-1) and the rest share RXM1 (filters 2-5), so each bank's mask is the intersection of its cubes' masks.
+/// @param bankA [MCP2515 only] Bit n set puts cube n on RXM0. Ignored on the Photon where every filter has its own mask.
+static void buildFilterPlan(const CANFilterCube *cubes, uint8_t cubeCount, uint8_t bankA, uint16_t fallbackId, CAN_FilterPlan &plan){
+    #if PLATFORM_ID == PLATFORM_PHOTON_PRODUCTION
+    (void)bankA;
+    (void)fallbackId;
+    plan.filterCount = cubeCount;
+    for(uint8_t c = 0; c < cubeCount; c++){
+        plan.filterIds[c] = cubes[c].value;
+        plan.filterMasks[c] = cubes[c].mask;
+    }
+    #else
+    static const uint8_t bankStart[2] = {0, 2};
+    static const uint8_t bankSize[2] = {2, 4};
+    for(uint8_t bank = 0; bank < 2; bank++){
+        uint16_t mask = 0x7FF;
+        uint8_t used = 0;
+        for(uint8_t c = 0; c < cubeCount; c++){
+            if(((bankA >> c) & 1) != (bank == 0)) continue;
+            mask &= cubes[c].mask;
+            plan.filterIds[bankStart[bank] + used++] = cubes[c].value;
+        }
+        if(used == 0) plan.filterIds[bankStart[bank] + used++] = fallbackId;          //Unused bank, point it at an ID we want anyway so it accepts nothing extra
+        for(uint8_t f = used; f < bankSize[bank]; f++) plan.filterIds[bankStart[bank] + f] = plan.filterIds[bankStart[bank]];  //Duplicate a filter rather than leave a stale one
+        for(uint8_t f = 0; f < bankSize[bank]; f++){
+            plan.filterMasks[bankStart[bank] + f] = mask;
+            plan.filterIds[bankStart[bank] + f] &= mask;
+        }
+    }
+    plan.filterCount = 6;
+    #endif
+    plan.falseAccepts = countHardwareAccepts(plan) - plan.acceptedIdCount;
+}
+
+/// @brief [Internal Function] Finds the hardware filter settings that let through the fewest unrequested IDs. Starts with one exact filter per ID and
+/// repeatedly merges the two filters whose merge adds the fewest extra IDs. Every step that fits in the hardware is scored exactly, and on the
+/// MCP2515 every way of splitting the filters across the two shared masks is tried.
+/// @param ids Sorted list of distinct standard IDs.
+static CAN_FilterPlan planAcceptanceFilters(const uint16_t *ids, uint8_t idCount){
+    CAN_FilterPlan best;
+    best.acceptedIdCount = idCount;
+    best.skippedIdCount = 0;
+    best.filterCount = CAN_MAX_HW_FILTERS;
+    for(uint8_t f = 0; f < CAN_MAX_HW_FILTERS; f++){                //No IDs, or nothing fits: accept everything
+        best.filterIds[f] = 0;
+        best.filterMasks[f] = 0;
+    }
+    best.falseAccepts = 0x800 - idCount;
+    best.softwareRejectRate = 0;
+    if(idCount == 0) return best;
+
+    CANFilterCube cubes[CAN_MAX_ACCEPTED_IDS];
+    uint8_t cubeCount = idCount;
+    for(uint8_t i = 0; i < idCount; i++){
+        cubes[i].value = ids[i];
+        cubes[i].mask = 0x7FF;
+    }
+
+    CAN_FilterPlan candidate;
+    candidate.acceptedIdCount = idCount;
+    while(true){
+        if(cubeCount <= CAN_MAX_HW_FILTERS){
+            #if PLATFORM_ID == PLATFORM_PHOTON_PRODUCTION
+            buildFilterPlan(cubes, cubeCount, 0, ids[0], candidate);    //Every filter has its own mask, so using more filters never hurts
+            if(candidate.falseAccepts < best.falseAccepts) best = candidate;
+            break;
+            #else
+            for(uint8_t bankA = 0; bankA < (1 << cubeCount); bankA++){
+                uint8_t onA = __builtin_popcount(bankA);
+                if(onA > 2 || cubeCount - onA > 4) continue;
+                buildFilterPlan(cubes, cubeCount, bankA, ids[0], candidate);
+                if(candidate.falseAccepts < best.falseAccepts) best = candidate;
+            }
+            if(best.falseAccepts == 0) break;
+            #endif
+        }
+        if(cubeCount == 1) break;
+
+        uint8_t mergeA = 0;
+        uint8_t mergeB = 1;
+        int32_t mergeCost = INT32_MAX;
+        for(uint8_t a = 0; a < cubeCount; a++){
+            for(uint8_t b = a + 1; b < cubeCount; b++){
+                int32_t cost = (int32_t)filterCubeSize(mergeFilterCubes(cubes[a], cubes[b])) - filterCubeSize(cubes[a]) - filterCubeSize(cubes[b]);
+                if(cost < mergeCost){
+                    mergeCost = cost;
+                    mergeA = a;
+                    mergeB = b;
+                }
+            }
+        }
+        CANFilterCube merged = mergeFilterCubes(cubes[mergeA], cubes[mergeB]);
+        uint8_t kept = 0;
+        for(uint8_t c = 0; c < cubeCount; c++){
+            if(c == mergeA || c == mergeB || filterCubeContains(merged, cubes[c])) continue;   //Drop the merged pair and anything the merge now covers
+            cubes[kept++] = cubes[c];
+        }
+        cubes[kept++] = merged;
+        cubeCount = kept;
+    }
+    best.softwareRejectRate = (float)best.falseAccepts / (best.falseAccepts + idCount);
+    return best;
+}
+
+/// @brief Replaces all receive filters so the CAN controller only passes the listed standard IDs, using the mask/filter settings that let through
+/// the fewest other IDs. Frames that slip through the hardware filters are thrown away in software by receive(). Pass an empty list to receive everything.
+/// The filters only hold standard IDs, so extended IDs in the list are left out and counted in skippedIdCount. Frames on them are only received
+/// if no standard IDs are listed, as an empty plan receives everything.
+/// Example: 'uint32_t ids[] = {0x100, 0x101, 0x6B0}; CAN_FilterPlan plan = controller.setAcceptedIds(ids, 3);'
+/// @param ids Array of standard (11-bit) CAN IDs to receive. At most CAN_MAX_ACCEPTED_IDS are used.
+/// @param idCount Number of elements in ids.
+/// @return The filter settings loaded into the hardware, including how many unwanted IDs still get through (falseAccepts, softwareRejectRate)
+/// and how many IDs were left out (skippedIdCount).
+CAN_FilterPlan CAN_Controller::setAcceptedIds(const uint32_t *ids, size_t idCount){
+    acceptedIdCount = 0;
+    uint16_t skipped = 0;
+    for(size_t i = 0; i < idCount; i++){
+        if(ids[i] > 0x7FF){                     //Masking an extended ID down to 11 bits would accept an unrelated standard ID instead
+            skipped++;
+            continue;
+        }
+        uint16_t id = ids[i];
+        uint8_t pos = 0;
+        while(pos < acceptedIdCount && acceptedIds[pos] < id) pos++;
+        if(pos < acceptedIdCount && acceptedIds[pos] == id) continue;       //Already in the list
+        if(acceptedIdCount == CAN_MAX_ACCEPTED_IDS){
+            skipped++;
+            continue;
+        }
+        memmove(&acceptedIds[pos + 1], &acceptedIds[pos], (acceptedIdCount - pos) * sizeof(uint16_t));
+        acceptedIds[pos] = id;
+        acceptedIdCount++;
+    }
+    currentFilterPlan = planAcceptanceFilters(acceptedIds, acceptedIdCount);
+    currentFilterPlan.skippedIdCount = skipped;
+    applyFilterPlan();
+    return currentFilterPlan;
+}
+
+/// @brief Adds a filter to the CAN bus receiving function to only allow messages with a specified address. Each call re-plans and reloads all
+/// hardware filters, so there is no longer a limit of six addresses on the MCP2515. To register more than a few addresses, put them in one list
+/// and call setAcceptedIds, which plans and loads the filters once.
+/// @param address Standard (11-bit) CAN address to receive.
+void CAN_Controller::addFilter(uint32_t address){
+    uint32_t ids[CAN_MAX_ACCEPTED_IDS + 1];
+    for(uint8_t i = 0; i < acceptedIdCount; i++) ids[i] = acceptedIds[i];
+    ids[acceptedIdCount] = address;
+    setAcceptedIds(ids, acceptedIdCount + 1);
+}
+
+/// @brief Returns the filter settings currently loaded into the CAN controller by setAcceptedIds or addFilter.
+CAN_FilterPlan CAN_Controller::filterPlan(){
+    return currentFilterPlan;
+}
+
+/// @brief [Internal Function] Software half of the acceptance filter. Checks frames that got through the hardware filters against the requested ID list.
+/// Frames with no address are dropped, except in sniffer mode, where everything is kept.
+/// @return True if the frame should be handed to the application.
+bool CAN_Controller::acceptsId(uint32_t addr){
+    if(sniffing) return true;
+    if(addr == 0) return false;
+    if(acceptedIdCount == 0 || currentFilterPlan.falseAccepts == 0) return true;     //Hardware filters are exact, nothing to check
+    uint8_t low = 0;
+    uint8_t high = acceptedIdCount;
+    while(low < high){
+        uint8_t mid = (low + high) / 2;
+        if(acceptedIds[mid] == addr) return true;
+        if(acceptedIds[mid] < addr) low = mid + 1;
+        else high = mid;
+    }
+    return false;
+}
+
+/// @brief Registers a handler for every frame received on a CAN ID. Call this from setup(); the lookup table is rebuilt on the next dispatch.
+/// @param addr CAN ID to route (standard 11-bit).
+/// @param handler Function to call with each frame on addr. Use CAN_Dispatcher::memberHandler to call a member function.
+/// @param context Pointer passed back to handler, usually the board object.
+/// @return False if CAN_DISPATCH_MAX_HANDLERS are already registered or addr already has a handler.
+bool CAN_Dispatcher::addHandler(uint32_t addr, CAN_Handler handler, void *context){
+    if(entryCount == CAN_DISPATCH_MAX_HANDLERS) return false;
+    uint8_t pos = 0;
+    while(pos < entryCount && entries[pos].addr < addr) pos++;
+    if(pos < entryCount && entries[pos].addr == addr) return false;
+    memmove(&entries[pos + 1], &entries[pos], (entryCount - pos) * sizeof(Entry));
+    entries[pos].addr = addr;
+    entries[pos].handler = handler;
+    entries[pos].context = context;
+    entryCount++;
+    built = false;
+    return true;
+}
+
+/// @brief [Internal Function] Maps a CAN ID to a slot in the dispatch table using the top bits of a multiplicative hash.
+uint8_t CAN_Dispatcher::hashSlot(uint32_t addr){
+    static_assert((CAN_DISPATCH_TABLE_SIZE & (CAN_DISPATCH_TABLE_SIZE - 1)) == 0, "CAN_DISPATCH_TABLE_SIZE must be a power of two");
+    return (uint8_t)((addr * hashMultiplier) >> (32 - __builtin_ctz(CAN_DISPATCH_TABLE_SIZE)));
+}
+
+/// @brief [Internal Function] Searches for a hash multiplier that puts every registered CAN ID in its own table slot, so dispatch is a single lookup.
+/// If none is found, dispatch falls back to a binary search of the sorted handler list.
+void CAN_Dispatcher::build(){
+    built = true;
+    uint32_t candidate = 0x9E3779B1;                        //Start from the golden ratio constant, step through odd multipliers with an LCG
+    for(uint16_t attempt = 0; attempt < 1024; attempt++){
+        hashMultiplier = candidate | 1;
+        memset(table, 0, sizeof(table));
+        bool collision = false;
+        for(uint8_t e = 0; e < entryCount && !collision; e++){
+            uint8_t slot = hashSlot(entries[e].addr);
+            if(table[slot]) collision = true;
+            else table[slot] = e + 1;
+        }
+        if(!collision) return;
+        candidate = candidate * 1664525 + 1013904223;
+    }
+    hashMultiplier = 0;
+}
+
+/// @brief Hands a frame to the handler registered for its CAN ID.
+/// @param msg The received frame.
+/// @return False if no handler is registered for msg.addr.
+bool CAN_Dispatcher::dispatch(const LV_CANMessage &msg){
+    if(!built) build();
+    if(hashMultiplier){
+        uint8_t e = table[hashSlot(msg.addr)];
+        if(e && entries[e - 1].addr == msg.addr){
+            entries[e - 1].handler(entries[e - 1].context, msg);
+            return true;
+        }
+    }
+    else{
+        uint8_t low = 0;
+        uint8_t high = entryCount;
+        while(low < high){
+            uint8_t mid = (low + high) / 2;
+            if(entries[mid].addr == msg.addr){
+                entries[mid].handler(entries[mid].context, msg);
+                return true;
+            }
+            if(entries[mid].addr < msg.addr) low = mid + 1;
+            else high = mid;
+        }
+    }
+    unhandled++;
+    return false;
+}
+
+/// @brief Receives frames from a CAN controller and dispatches each one to its handler. Call this from loop() instead of receive() + receiveCANData.
+/// Frames are handed to the handlers in place with peekReceive(), without copying them out of the controller's receive storage.
+/// @param controller The CAN controller to receive from.
+/// @param maxFrames Upper limit on frames handled per call, so a busy bus can't hold up loop().
+/// @return Number of frames received.
+size_t CAN_Dispatcher::poll(CAN_Controller &controller, size_t maxFrames){
+    size_t total = 0;
+    const LV_CANMessage *msg;
+    while(total < maxFrames && (msg = controller.peekReceive()) != NULL){
+        dispatch(*msg);
+        controller.releaseReceive();
+        total++;
+    }
+    return total;
+}
+
+/// @brief Returns the number of frames dispatched that had no handler registered for their CAN ID.
+uint32_t CAN_Dispatcher::unhandledCount(){
+    return unhandled;
+}
+
+/// @brief Adds a bus to be serviced by poll().
+/// @param controller CAN controller for the bus, already started with begin().
+/// @param dispatcher Dispatcher holding the handlers for frames received on this bus.
+/// @param quantum Most frames dispatched from this bus per poll(). Give a busy bus a larger share so its receive ring doesn't fill.
+/// @return False if CAN_BUS_MANAGER_MAX_BUSES buses were already added.
+bool CAN_BusManager::addBus(CAN_Controller &controller, CAN_Dispatcher &dispatcher, uint8_t quantum){
+    if(count >= CAN_BUS_MANAGER_MAX_BUSES) return false;
+    controllers[count] = &controller;
+    dispatchers[count] = &dispatcher;
+    quanta[count] = quantum > 0 ? quantum : 1;
+    count++;
+    return true;
+}
+
+/// @brief Services every bus once, starting from a different bus each call: loads queued transmit frames into the hardware, then
+/// dispatches up to the bus's quantum of received frames. Call from loop().
+/// @return Number of frames dispatched across all buses.
+size_t CAN_BusManager::poll(){
+    size_t total = 0;
+    for(uint8_t i = 0; i < count; i++){
+        uint8_t bus = (nextBus + i) % count;
+        controllers[bus]->serviceTx();
+        total += dispatchers[bus]->poll(*controllers[bus], quanta[bus]);
+    }
+    if(count > 0) nextBus = (nextBus + 1) % count;
+    return total;
+}
+
+/// @brief Records that a frame from the board was just parsed. Call from the board's receive function.
+/// @param msg The frame that was parsed. Its rxTimestampUs is used when it has one.
+void CAN_ReceiveClock::stamp(const LV_CANMessage &msg){
+    lastUs = msg.receivedAtUs();
+    lastMs = millis();
+    received = true;
+    expired = false;
+}
+
+/// @brief Returns how old the board's data is, measured from when its last frame came out of the CAN controller. Example: 'if(dc.dataAgeUs() > 100000) //No update in 100ms'
+/// micros() wraps every 71 minutes, so the age is only measured in microseconds while millis() says it is under CAN_MAX_AGE_MS. Past that it
+/// latches to CAN_AGE_EXPIRED_US until the next frame, so a board that went silent never comes back fresh on a wrap.
+/// @return Microseconds since the last frame was received, CAN_AGE_EXPIRED_US if that is over CAN_MAX_AGE_MS, or UINT32_MAX if nothing has been received yet.
+uint32_t CAN_ReceiveClock::ageUs(){
+    if(!received) return UINT32_MAX;
+    if(!expired && millis() - lastMs >= CAN_MAX_AGE_MS) expired = true;
+    if(expired) return CAN_AGE_EXPIRED_US;
+    return micros() - lastUs;
+}
+
+/// @brief Checks whether the board is still on the bus. Example: 'if(!dc.isFresh(300)) //Lost the board, fall back to safe defaults'
+/// @param timeoutMs Longest gap allowed since the last frame, normally a few of the board's send periods. Capped at CAN_MAX_AGE_MS.
+/// @return True if a frame from the board was received within the last timeoutMs.
+bool CAN_ReceiveClock::isFresh(uint32_t timeoutMs){
+    if(timeoutMs > CAN_MAX_AGE_MS) timeoutMs = CAN_MAX_AGE_MS;
+    return ageUs() <= timeoutMs * 1000;
+}
+
+/// @brief [Internal Function] Adds a board to the table, used by addBoard. A zero timeout is rejected, it would make every board stale.
+int8_t CAN_LivenessTable::addEntry(CAN_AgeFunction age, void *board, uint32_t timeoutMs, const char *name){
+    if(entryCount >= CAN_LIVENESS_MAX_BOARDS || timeoutMs == 0) return -1;
+    Entry &entry = entries[entryCount];
+    entry.age = age;
+    entry.board = board;
+    entry.timeoutUs = (timeoutMs > CAN_MAX_AGE_MS ? CAN_MAX_AGE_MS : timeoutMs) * 1000;
+    entry.name = name;
+    entry.fresh = false;                    //Not fresh until its first frame, but that doesn't count as a dropout
+    entry.missed = 0;
+    entry.dropouts = 0;
+    return entryCount++;
+}
+
+/// @brief Re-checks the age of every board. A board that goes quiet is reported stale within one timeout plus one update() period.
+void CAN_LivenessTable::update(){
+    for(uint8_t i = 0; i < entryCount; i++){
+        Entry &entry = entries[i];
+        uint32_t age = entry.age(entry.board);
+        bool fresh = age <= entry.timeoutUs;
+        if(entry.fresh && !fresh) entry.dropouts++;
+        entry.fresh = fresh;
+        entry.missed = fresh || age == UINT32_MAX ? 0 : age / entry.timeoutUs;
+    }
+}
+
+/// @brief Returns whether the board at index was heard from within its timeout at the last update().
+bool CAN_LivenessTable::isFresh(int8_t index){
+    if(index < 0 || index >= entryCount) return false;
+    return entries[index].fresh;
+}
+
+/// @brief Returns true if every board in the table was fresh at the last update().
+bool CAN_LivenessTable::allFresh(){
+    return staleCount() == 0;
+}
+
+/// @brief Returns the number of boards that were not fresh at the last update(), including boards never heard from.
+uint8_t CAN_LivenessTable::staleCount(){
+    uint8_t stale = 0;
+    for(uint8_t i = 0; i < entryCount; i++) stale += !entries[i].fresh;
+    return stale;
+}
+
+/// @brief Returns how many whole timeout periods have passed since the board was last heard from. 0 while it is fresh or if it was never heard from.
+uint32_t CAN_LivenessTable::missedHeartbeats(int8_t index){
+    if(index < 0 || index >= entryCount) return 0;
+    return entries[index].missed;
+}
+
+/// @brief Returns the number of times the board went from fresh to stale.
+uint16_t CAN_LivenessTable::dropoutCount(int8_t index){
+    if(index < 0 || index >= entryCount) return 0;
+    return entries[index].dropouts;
+}
+
+/// @brief Returns the name given to addBoard, for printing.
+const char *CAN_LivenessTable::name(int8_t index){
+    if(index < 0 || index >= entryCount) return "";
+    return entries[index].name;
+}
+
+/// @brief Returns the number of boards in the table.
+uint8_t CAN_LivenessTable::boardCount(){
+    return entryCount;
+}
+
+/// @brief Adds a periodic frame to the schedule.
+/// @param addr CAN ID of the frame. IDs above 0x7FF are sent as extended frames.
+/// @param periodMs Time between sends of the frame, in ms.
+/// @param builder Function that fills in the frame's data each period. Use memberBuilder to call a member function of a board class.
+/// @param context Pointer passed to builder, usually the board object.
+/// @param phaseMs Offset of the frame within its period, in ms. Leave as CAN_SCHED_AUTO_PHASE to have the scheduler spread frames out.
+/// @return Index of the frame, or -1 if CAN_SCHED_MAX_FRAMES frames were already added.
+int8_t CAN_PeriodicScheduler::addFrame(uint32_t addr, uint16_t periodMs, CAN_FrameBuilder builder, void *context, uint16_t phaseMs){
+    if(entryCount >= CAN_SCHED_MAX_FRAMES || periodMs == 0) return -1;
+    Entry &entry = entries[entryCount];
+    entry.addr = addr;
+    entry.builder = builder;
+    entry.context = context;
+    entry.periodMs = periodMs;
+    entry.phaseMs = phaseMs == CAN_SCHED_AUTO_PHASE ? pickPhase(periodMs) : phaseMs % periodMs;
+    entry.retrying = false;
+    if(started){                            //Added while running, line it up with the frames already going out
+        entry.nextDue = epoch + entry.phaseMs;
+        uint32_t late = millis() - entry.nextDue;
+        if((int32_t)late >= 0) entry.nextDue += periodMs * (late / periodMs + 1);
+    }
+    return entryCount++;
+}
+
+/// @brief [Internal Function] Finds the slot in a new frame's period that is shared with the fewest sends of the frames already added.
+/// Two frames with periods A and B meet once every lcm(A, B) if their phases are within a slot of each other modulo gcd(A, B), so each
+/// clash is weighted by how often it happens.
+/// @param periodMs Period of the frame being added.
+/// @return Phase offset in ms, a multiple of CAN_SCHED_SLOT_MS.
+uint16_t CAN_PeriodicScheduler::pickPhase(uint16_t periodMs){
+    uint16_t bestPhase = 0;
+    uint32_t bestLoad = UINT32_MAX;
+    for(uint16_t phase = 0; phase < periodMs; phase += CAN_SCHED_SLOT_MS){
+        uint32_t load = 0;
+        for(uint8_t i = 0; i < entryCount && load < bestLoad; i++){
+            uint16_t a = periodMs, b = entries[i].periodMs;
+            while(b != 0){ uint16_t t = a % b; a = b; b = t; }      //a = gcd of the two periods
+            uint16_t offset = (phase + a - entries[i].phaseMs % a) % a;
+            if(offset < CAN_SCHED_SLOT_MS || a - offset < CAN_SCHED_SLOT_MS) load += (uint32_t)a * 1000 / entries[i].periodMs;
+        }
+        if(load < bestLoad){
+            bestLoad = load;
+            bestPhase = phase;
+            if(load == 0) break;
+        }
+    }
+    return bestPhase;
+}
+
+/// @brief Sends every frame whose time has come. Call from loop() at least every CAN_SCHED_SLOT_MS to keep the frames spread out.
+/// A frame held up by a slow loop() is sent once and skips the periods it missed, so it keeps its phase instead of bunching up with others.
+/// A frame dropped because the transmit queue was full is retried CAN_SCHED_SLOT_MS later. A suppressed frame waits for its next period.
+/// @param controller The CAN bus controller to send on.
+/// @return Number of frames sent or queued by the controller.
+uint8_t CAN_PeriodicScheduler::service(CAN_Controller &controller){
+    uint32_t now = millis();
+    if(!started){
+        epoch = now;
+        for(uint8_t i = 0; i < entryCount; i++){
+            entries[i].nextDue = epoch + entries[i].phaseMs;
+            entries[i].retrying = false;
+        }
+        started = true;
+    }
+    uint8_t sent = 0;
+    for(uint8_t i = 0; i < entryCount; i++){
+        Entry &entry = entries[i];
+        uint32_t late = now - entry.nextDue;
+        if((int32_t)late < 0) continue;     //Not due yet
+        if(entry.retrying && (int32_t)(now - entry.retryAt) < 0) continue;
+        LV_CANMessage msg;
+        msg.addr = entry.addr;
+        msg.extended = entry.addr > 0x7FF;
+        uint8_t result = entry.builder(entry.context, msg) ? controller.CANSend(msg) : CAN_TX_SUPPRESSED;
+        if(result == CAN_TX_DROPPED){       //Queue was full, keep nextDue so the frame still skips any periods it misses meanwhile
+            entry.retrying = true;
+            entry.retryAt = now + CAN_SCHED_SLOT_MS;
+            continue;
+        }
+        entry.retrying = false;
+        entry.nextDue += entry.periodMs * (late / entry.periodMs + 1);
+        if(result < CAN_TX_DROPPED) sent++;
+    }
+    return sent;
+}
+
+/// @brief Starts the schedule over: the next service() treats every frame as due at its phase from that moment.
+void CAN_PeriodicScheduler::restart(){
+    started = false;
+}
+
+/// @brief Removes every frame from the schedule.
+void CAN_PeriodicScheduler::clear(){
+    entryCount = 0;
+    started = false;
+}
+
+/// @brief Returns the phase offset the frame at index was given, in ms.
+uint16_t CAN_PeriodicScheduler::phaseOf(int8_t index){
+    if(index < 0 || index >= entryCount) return 0;
+    return entries[index].phaseMs;
+}
+
+/// @brief Returns the number of frames in the schedule.
+uint8_t CAN_PeriodicScheduler::frameCount(){
+    return entryCount;
+}
+
+/// @brief Returns the number of buses added with addBus.
+uint8_t CAN_BusManager::busCount(){
+    return count;
+}
+
+/// @brief Creates a sniffer stream that writes to a USB serial port. Open the port with a large baud rate, e.g. 'Serial.begin(2000000);'.
+/// @param serialPort Port to stream the records to.
+CAN_SnifferStream::CAN_SnifferStream(USBSerial &serialPort){
+    port = &serialPort;
+}
+
+/// @brief [Internal Function] Returns the number of bytes that can be added to the buffer. One byte is kept empty to tell a full buffer from an empty one.
+uint16_t CAN_SnifferStream::freeSpace(){
+    return (uint16_t)((tail - head - 1) & (CAN_SNIFFER_BUFFER_SIZE - 1));
+}
+
+/// @brief [Internal Function] Encodes one record into the buffer. The caller checks there is room for CAN_SNIFFER_RECORD_MAX bytes.
+/// @param flags Record flags, including the data length.
+/// @param timestamp Receive time in microseconds.
+/// @param field ID, or the drop count for CAN_SNIFFER_FLAG_DROPPED records.
+/// @param fieldBytes Bytes of field to write (2 or 4).
+void CAN_SnifferStream::putRecord(uint8_t flags, uint32_t timestamp, uint32_t field, uint8_t fieldBytes, const uint8_t *data, uint8_t len){
+    const uint16_t wrap = CAN_SNIFFER_BUFFER_SIZE - 1;
+    uint8_t checksum = 0;
+    buffer[head] = CAN_SNIFFER_SYNC;
+    head = (head + 1) & wrap;
+    uint8_t header[9] = {flags, (uint8_t)timestamp, (uint8_t)(timestamp >> 8), (uint8_t)(timestamp >> 16), (uint8_t)(timestamp >> 24),
+                         (uint8_t)field, (uint8_t)(field >> 8), (uint8_t)(field >> 16), (uint8_t)(field >> 24)};
+    for(uint8_t i = 0; i < 5 + fieldBytes; i++){
+        buffer[head] = header[i];
+        head = (head + 1) & wrap;
+        checksum += header[i];
+    }
+    for(uint8_t i = 0; i < len; i++){
+        buffer[head] = data[i];
+        head = (head + 1) & wrap;
+        checksum += data[i];
+    }
+    buffer[head] = checksum;
+    head = (head + 1) & wrap;
+}
+
+/// @brief Encodes a frame into the buffer to be sent by the next flush().
+/// @return False if the buffer was full and the frame was dropped.
+bool CAN_SnifferStream::add(const LV_CANMessage &msg){
+    if(freeSpace() < CAN_SNIFFER_RECORD_MAX){
+        dropped++;
+        return false;
+    }
+    uint8_t len = msg.len > 8 ? 8 : msg.len;
+    putRecord(len | (msg.extended ? CAN_SNIFFER_FLAG_EXTENDED : 0), msg.rxTimestampUs, msg.addr, msg.extended ? 4 : 2, msg.data(), len);
+    return true;
+}
+
+/// @brief Writes as much of the buffer as the serial port accepts right now, in at most two blocks. Also adds a CAN_SNIFFER_FLAG_DROPPED record
+/// whenever frames were lost since the last one, so the capture shows where the gaps are.
+void CAN_SnifferStream::flush(){
+    while(head != tail){
+        int room = port->availableForWrite();
+        if(room <= 0) break;
+        uint16_t block = head > tail ? head - tail : CAN_SNIFFER_BUFFER_SIZE - tail;    //Up to the end of the buffer, the rest goes in the next pass
+        if(block > room) block = room;
+        port->write(buffer + tail, block);
+        tail = (tail + block) & (CAN_SNIFFER_BUFFER_SIZE - 1);
+    }
+    if(dropped != reportedDropped && freeSpace() >= CAN_SNIFFER_RECORD_MAX){
+        putRecord(CAN_SNIFFER_FLAG_DROPPED, micros(), dropped, 4, NULL, 0);
+        reportedDropped = dropped;
+    }
+}
+
+/// @brief Encodes frames received by the controller and writes them out. Frames are left in the controller once the buffer is full, so they wait
+/// in its receive ring rather than being dropped here.
+/// @return Number of frames encoded.
+size_t CAN_SnifferStream::poll(CAN_Controller &controller, size_t maxFrames){
+    size_t total = 0;
+    const LV_CANMessage *msg;
+    while(total < maxFrames){
+        if(freeSpace() < CAN_SNIFFER_RECORD_MAX){
+            flush();
+            if(freeSpace() < CAN_SNIFFER_RECORD_MAX) break;
+        }
+        if((msg = controller.peekReceive()) == NULL) break;
+        add(*msg);
+        controller.releaseReceive();
+        total++;
+    }
+    flush();
+    return total;
+}
+
+/// @brief Returns the number of frames lost because the buffer was full.
+uint32_t CAN_SnifferStream::droppedCount(){
+    return dropped;
 }
 
 #if PLATFORM_ID == PLATFORM_PHOTON_PRODUCTION   //When running on a board with a photon, use the integrated CAN bus controller
 
+/// @brief [Internal Function] Copies a frame received by the Particle CANChannel into an LV_CANMessage.
+static void copyParticleMessage(const CANMessage &inputMessage, LV_CANMessage &outputMessage){
+    uint8_t len = inputMessage.len > 8 ? 8 : inputMessage.len;
+    outputMessage.addr = inputMessage.id;
+    outputMessage.len = len;
+    outputMessage.extended = inputMessage.extended;
+    outputMessage.rxTimestampUs = micros();            //The CANChannel doesn't timestamp frames, take the time they leave its queue
+    memcpy(outputMessage.data(), inputMessage.data, len);
+    memset(outputMessage.data() + len, 0, 8 - len);    //Bytes past len are left over from an older frame in the CANMessage, zero them
+}
+
 /// @brief Initializes the CAN bus controller on the photon with the specified speed.
 /// @param baudRate Baud rate in bits per second.
 void CAN_Controller::begin(unsigned long baudRate){
+    txBurstDepth = 0;
+    txHistoryNext = 0;
+    peekValid = false;
+    sniffing = false;
+    acceptedIdCount = 0;
+    currentFilterPlan = planAcceptanceFilters(acceptedIds, 0);
     currentBaudRate = convertBaudRateToParticle(baudRate);
     can.begin(currentBaudRate);
+    resetBusStats();
 }
 
-/// @brief Adds a filter to the CAN bus receiving function to only allow messages with a specified address.
-/// @param address Baud rate in bits per second.
-/// @param mask [Advanced] Bit mask for CAN address. Most cases will be 0x7FF
-void CAN_Controller::addFilter(uint32_t address){
-    can.addFilter(address, 0x7FF);
+/// @brief [Internal Function] Restarts the Photon's CAN peripheral after bus-off, which clears its error counters.
+void CAN_Controller::restartController(){
+    can.end();
+    can.begin(currentBaudRate);
+    applyFilterPlan();
+}
+
+/// @brief [Internal Function] Reads the error state of the Photon's CAN peripheral. Device OS only reports the state, not the TEC/REC counters.
+void CAN_Controller::sampleErrorCounters(CAN_BusStats &stats){
+    stats.txErrorCount = 0;
+    stats.rxErrorCount = 0;
+    switch(can.errorStatus()){
+        case CAN_BUS_OFF: stats.errorState = CAN_STATE_BUS_OFF; break;
+        case CAN_ERROR_PASSIVE: stats.errorState = CAN_STATE_ERROR_PASSIVE; break;
+        default: stats.errorState = CAN_STATE_ERROR_ACTIVE; break;
+    }
+}
+
+/// @brief [Internal Function] Loads currentFilterPlan into the Photon's CAN filter banks.
+void CAN_Controller::applyFilterPlan(){
+    can.clearFilters();
+    if(acceptedIdCount == 0) return;                //No filters means receive everything
+    for(uint8_t f = 0; f < currentFilterPlan.filterCount; f++){
+        can.addFilter(currentFilterPlan.filterIds[f], currentFilterPlan.filterMasks[f]);
+    }
 }
 
 /// @brief Checks if a message was received on CAN bus and populates the LV_CANMessage with the received data. Do 'LV_CANMessage message;' then 'controller.receive(message);'.
 /// @param outputMessage CAN bus message that will be returned by the CAN controller (returns reference). 
 /// @return Boolean indicating whether or not a message was received from the CAN bus
 bool CAN_Controller::receive(LV_CANMessage &outputMessage){
+    if(takePeekedFrame(outputMessage)) return true;     //A frame peeked but not released comes first
+    if(txQueue.count()) serviceTx();                //Opportunistically keep the transmit queue moving
     CANMessage inputMessage;
-    bool receivedMessage = can.receive(inputMessage);
-    if(!receivedMessage) return receivedMessage;    //Didn't receive anything from CAN, don't bother processing input message data.
-    if(inputMessage.id == 0) return false;
-    outputMessage.addr = inputMessage.id;
-    outputMessage.byte0 = inputMessage.data[0];
-    outputMessage.byte1 = inputMessage.data[1];
-    outputMessage.byte2 = inputMessage.data[2];
-    outputMessage.byte3 = inputMessage.data[3];
-    outputMessage.byte4 = inputMessage.data[4];
-    outputMessage.byte5 = inputMessage.data[5];
-    outputMessage.byte6 = inputMessage.data[6];
-    outputMessage.byte7 = inputMessage.data[7];
-    return true;
+    while(can.receive(inputMessage)){
+        recordFrame(false, inputMessage.len, inputMessage.extended);
+        if(!acceptsId(inputMessage.id)) continue;      //Not meant for us, got past the hardware filters
+        copyParticleMessage(inputMessage, outputMessage);
+        return true;
+    }
+    return false;                                   //Didn't receive anything from CAN
 }
 
-/// @brief Checks if a message was received on CAN bus and populates the LV_CANMessage with the received data. Do 'LV_CANMessage message;' then 'controller.receive(message);'.
-/// @param outputMessage CAN bus message that will be returned by the CAN controller (returns reference). 
-/// @return Boolean indicating whether or not a message was received from the CAN bus
+/// @brief Returns the next received frame without copying it into caller storage. The frame stays valid until releaseReceive(). Example:
+/// 'const LV_CANMessage *msg = controller.peekReceive(); if(msg){ dc.receiveCANData(*msg); controller.releaseReceive(); }'
+/// @return Pointer to the frame, or NULL if nothing was received.
+const LV_CANMessage *CAN_Controller::peekReceive(){
+    if(!peekValid) peekValid = receive(peekSlot);
+    return peekValid ? &peekSlot : NULL;
+}
+
+/// @brief Frees the frame returned by peekReceive().
+void CAN_Controller::releaseReceive(){
+    peekValid = false;
+}
+
+/// @brief Pulls every frame waiting in the CAN controller in one call. Use this instead of calling receive() in a loop when a burst of frames is expected.
+/// @param outputMessages Array of LV_CANMessage to populate with the received frames (returns reference).
+/// @param maxMessages Number of elements in outputMessages.
+/// @return Number of frames written to outputMessages.
+size_t CAN_Controller::receiveBatch(LV_CANMessage *outputMessages, size_t maxMessages){
+    if(txQueue.count()) serviceTx();
+    size_t received = 0;
+    if(maxMessages && takePeekedFrame(outputMessages[0])) received++;     //A frame peeked but not released comes first
+    CANMessage inputMessage;
+    while(received < maxMessages && can.receive(inputMessage)){
+        recordFrame(false, inputMessage.len, inputMessage.extended);
+        if(!acceptsId(inputMessage.id)) continue;
+        copyParticleMessage(inputMessage, outputMessages[received]);
+        received++;
+    }
+    return received;
+}
+
+/// @brief Reinitializes the CAN controller with a new CAN Bus baud rate.
+/// @param newCanSpeed New CAN Bus speed in bps. 
 void CAN_Controller::changeCANSpeed(uint32_t newCanSpeed){
     can.end();
-    currentBaudRate = convertBaudRateToMCP(newCanSpeed);
+    currentBaudRate = convertBaudRateToParticle(newCanSpeed);
     can.begin(currentBaudRate);
+    setSnifferMode(sniffing);                       //Loads the filters back, or keeps them open while sniffing
+}
+
+/// @brief Turns sniffer mode on or off. In sniffer mode every frame on the bus is received, including extended and ID 0 frames, and CANSend returns
+/// CAN_TX_SUPPRESSED. The Photon's CANChannel has no listen-only mode, so it still acknowledges frames; capture with an MCP2515 to stay off the bus.
+/// @param enabled True to start sniffing, false to go back to the filters set with setAcceptedIds/addFilter.
+void CAN_Controller::setSnifferMode(bool enabled){
+    sniffing = enabled;
+    if(enabled) can.clearFilters();
+    else applyFilterPlan();
+}
+
+/// @brief [Internal Function] Restarts the CAN peripheral at a candidate rate for autoDetectBaud with every filter open. The Photon's CANChannel has
+/// no listen-only mode, so this is normal mode.
+void CAN_Controller::startListening(uint32_t bitsPerSecond){
+    can.end();
+    can.clearFilters();
+    can.begin(bitsPerSecond);
+}
+
+/// @brief [Internal Function] Counts the frames received since the last call and whether the peripheral has seen bus errors, for autoDetectBaud.
+/// @param frames Incremented for every frame received (returns reference).
+/// @param errors Incremented when the peripheral has left error-active (returns reference).
+void CAN_Controller::listenForFrames(uint16_t &frames, uint16_t &errors){
+    CANMessage message;
+    while(can.receive(message)) frames++;
+    if(can.errorStatus() != CAN_NO_ERROR) errors++;
 }
 
 /// @brief Returns the current baud rate of the CAN controller
@@ -564,46 +1863,14 @@ uint32_t CAN_Controller::CurrentBaudRate(){
     return currentBaudRate;
 }
 
-/// @brief [Internal Function] Manually sends a CAN bus packet using the CAN bus controller on the address specified with the inputted data. Example: 'CANSend(0x100, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08);' transmits on address 0x100 with the data [1,2,3,4,5,6,7,8]
-/// @param Can_addr CAN Bus address to transmit on
-/// @param data0 CAN Bus Data 0 field (8 bits)
-/// @param data1 CAN Bus Data 1 field (8 bits)
-/// @param data2 CAN Bus Data 2 field (8 bits)
-/// @param data3 CAN Bus Data 3 field (8 bits)
-/// @param data4 CAN Bus Data 4 field (8 bits)
-/// @param data5 CAN Bus Data 5 field (8 bits)
-/// @param data6 CAN Bus Data 6 field (8 bits)
-/// @param data7 CAN Bus Data 7 field (8 bits)
-void CAN_Controller::CANSend(uint16_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7){
-    CANMessage txMessage;
-    txMessage.id = Can_addr;
-    txMessage.len = 8;
-    txMessage.data[0] = data0;
-    txMessage.data[1] = data1;
-    txMessage.data[2] = data2;
-    txMessage.data[3] = data3;
-    txMessage.data[4] = data4;
-    txMessage.data[5] = data5;
-    txMessage.data[6] = data6;
-    txMessage.data[7] = data7;
-    
-    can.transmit(txMessage);
-}
-
-/// @brief [Internal Function] Manually sends a CAN bus packet using the CAN bus controller on the address specified with the inputted data. Example: 'CANSend(0x100, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08);' transmits on address 0x100 with the data [1,2,3,4,5,6,7,8]
-/// @param Can_addr CAN Bus address to transmit on
-/// @param data0 CAN Bus Data 0 field (8 bits)
-/// @param data1 CAN Bus Data 1 field (8 bits)
-/// @param data2 CAN Bus Data 2 field (8 bits)
-/// @param data3 CAN Bus Data 3 field (8 bits)
-/// @param data4 CAN Bus Data 4 field (8 bits)
-/// @param data5 CAN Bus Data 5 field (8 bits)
-/// @param data6 CAN Bus Data 6 field (8 bits)
-/// @param data7 CAN Bus Data 7 field (8 bits)
-void CAN_Controller::CANSend(LV_CANMessage inputMessage){
+/// @brief [Internal Function] Hands a frame to the Particle CANChannel transmit queue.
+/// @return False if the CANChannel queue is full.
+static bool transmitParticleMessage(const LV_CANMessage &inputMessage){
     CANMessage txMessage;
     txMessage.id = inputMessage.addr;
-    txMessage.len = 8;
+    txMessage.extended = inputMessage.extended;
+    txMessage.rtr = false;
+    txMessage.len = inputMessage.len > 8 ? 8 : inputMessage.len;
     txMessage.data[0] = inputMessage.byte0;
     txMessage.data[1] = inputMessage.byte1;
     txMessage.data[2] = inputMessage.byte2;
@@ -612,67 +1879,614 @@ void CAN_Controller::CANSend(LV_CANMessage inputMessage){
     txMessage.data[5] = inputMessage.byte5;
     txMessage.data[6] = inputMessage.byte6;
     txMessage.data[7] = inputMessage.byte7;
-    
-    can.transmit(txMessage);
+    return can.transmit(txMessage);
+}
+
+/// @brief Sends a CAN bus packet using the CAN bus controller. If the hardware is busy, the frame waits in a priority-ordered transmit queue instead of blocking.
+/// @param inputMessage The frame to send.
+/// @return CAN_TX_SENT, CAN_TX_QUEUED or CAN_TX_DROPPED.
+uint8_t CAN_Controller::CANSend(LV_CANMessage inputMessage){
+    updateBusHealth();
+    if(sniffing || (!healthy && inputMessage.addr > recoveryPolicy.suppressAboveId)) return CAN_TX_SUPPRESSED;
+    if(txBurstDepth || txHeld) return txQueue.push(inputMessage) ? CAN_TX_QUEUED : CAN_TX_DROPPED;    //Held until endTxBurst() or bus-off recovery
+    serviceTx();                                                                    //Older frames get first shot at the hardware
+    if(txQueue.count() == 0 && transmitParticleMessage(inputMessage)){
+        recordFrame(true, inputMessage.len, inputMessage.extended);
+        recordTxComplete(inputMessage);
+        return CAN_TX_SENT;
+    }
+    return txQueue.push(inputMessage) ? CAN_TX_QUEUED : CAN_TX_DROPPED;
+}
+
+/// @brief Moves queued frames into the CANChannel until it is full. Called from CANSend and receive, but can also be called from loop() to keep the queue moving.
+void CAN_Controller::serviceTx(){
+    updateBusHealth();
+    if(txHeld) return;
+    LV_CANMessage txMessage;
+    while(txQueue.peek(txMessage)){
+        if(!transmitParticleMessage(txMessage)) return;
+        txQueue.pop(txMessage);
+        recordFrame(true, txMessage.len, txMessage.extended);
+        recordTxComplete(txMessage);
+    }
 }
 
 #else
 
-/// @brief Initializes the MCP2515 CAN bus controller on the P2/other with the specified speed and chip select pin.
+//MCP2515 SPI instructions and registers used for direct access (see the MCP2515 datasheet, section 12)
+#define MCP2515_INSTR_WRITE         0x02
+#define MCP2515_INSTR_READ          0x03
+#define MCP2515_INSTR_BIT_MODIFY    0x05
+#define MCP2515_INSTR_READ_STATUS   0xA0
+#define MCP2515_INSTR_RTS           0x80    //OR with the bit mask of the transmit buffers to send
+#define MCP2515_INSTR_READ_RX       0x90    //READ RX BUFFER starting at RXB0SIDH, 0x94 starts at RXB1SIDH. Clears the buffer's RXnIF when CS goes high.
+#define MCP2515_INSTR_LOAD_TX       0x40    //LOAD TX BUFFER starting at TXB0SIDH, 0x42 and 0x44 start at TXB1SIDH and TXB2SIDH
+#ifndef MCP2515_SPI_DMA
+#define MCP2515_SPI_DMA             1       //1 moves frame data with the DMA form of SPI.transfer when not in an interrupt, 0 always transfers byte by byte
+#endif
+#define MCP2515_REG_TEC             0x1C    //REC follows at 0x1D
+#define MCP2515_REG_EFLG            0x2D
+#define MCP2515_EFLG_TXBO           0x20    //Bus-off
+#define MCP2515_EFLG_TXEP           0x10    //Transmit error-passive
+#define MCP2515_EFLG_RXEP           0x08    //Receive error-passive
+#define MCP2515_REG_CANINTE         0x2B
+#define MCP2515_REG_CANINTF         0x2C
+#define MCP2515_REG_TXB0CTRL        0x30    //TXB1CTRL and TXB2CTRL follow every 0x10
+#define MCP2515_REG_RXB0CTRL        0x60
+#define MCP2515_REG_RXB1CTRL        0x70
+#define MCP2515_RXM_ANY             0x60    //RXM bits in RXBnCTRL: receive any frame, masks and filters off
+#define MCP2515_SIDL_EXIDE          0x08    //Extended identifier enable bit in TXBnSIDL
+#define MCP2515_INT_TX0             0x04    //TX0 interrupt bit in CANINTE / CANINTF, TX1 and TX2 follow
+#define MCP2515_INT_TX_ALL          0x1C    //TX0, TX1 and TX2 interrupt bits in CANINTE / CANINTF
+#define MCP2515_INT_MERR            0x80    //Message error flag in CANINTF, set for every malformed frame seen (including in listen-only mode)
+#define MCP2515_STATUS_RX0IF        0x01    //READ STATUS bits
+#define MCP2515_STATUS_RX1IF        0x02
+#define MCP2515_STATUS_TX0REQ       0x04
+#define MCP2515_STATUS_TX0IF        0x08
+#define MCP2515_STATUS_TX1REQ       0x10
+#define MCP2515_STATUS_TX1IF        0x20
+#define MCP2515_STATUS_TX2REQ       0x40
+#define MCP2515_STATUS_TX2IF        0x80
+
+volatile uint8_t CAN_Controller::spiLockDepth = 0;
+CAN_Controller *CAN_Controller::controllers[CAN_MAX_CONTROLLERS];
+uint8_t CAN_Controller::controllerCount = 0;
+uint8_t CAN_Controller::nextServiced = 0;
+
+/// @brief Initializes the MCP2515 CAN bus controller on the P2/other with the specified speed and chip select pin. Several controllers can share the
+/// SPI bus, each with its own chip select pin; calling begin() again on the same controller reuses its MCP_CAN object.
 /// @param baudRate Baud rate in bits per second.
 void CAN_Controller::begin(unsigned long baudRate, uint8_t chipSelectPin){
+    if(CAN0 != NULL && csPin != chipSelectPin){
+        delete CAN0;
+        CAN0 = NULL;
+    }
     csPin = chipSelectPin;
     currentBaudRate = convertBaudRateToMCP(baudRate);
-    CAN0 = new MCP_CAN(chipSelectPin);
+    interruptEnabled = false;
+    interruptPending = false;
+    lockSPI();                                  //Another controller's interrupt may be using the SPI bus
+    if(CAN0 == NULL) CAN0 = new MCP_CAN(chipSelectPin);
     Serial.printlnf("Begin at %d", currentBaudRate);
     CAN0->begin(MCP_STDEXT, currentBaudRate, MCP_8MHZ);
     CAN0->setMode(MCP_NORMAL);
     SPI.setClockSpeed(8000000);
-    filterIndex = 0;
+    memset(txBufferPriority, 0, sizeof(txBufferPriority));    //Reset clears TXBnCTRL
+    unlockSPI();
+    registerController();
+    acceptedIdCount = 0;
+    currentFilterPlan = planAcceptanceFilters(acceptedIds, 0);
+    txPipelined = true;
+    txBurstDepth = 0;
+    txHistoryNext = 0;
+    peekValid = false;
+    ringPeeked = false;
+    sniffing = false;
+    txQueue.clear();
+    resetBusStats();
 }
 
-/// @brief Adds a filter to the CAN bus receiving function to only allow messages with a specified address.
-/// @param address Baud rate in bits per second.
-/// @param mask [Advanced] Bit mask for CAN address. Most cases will be 0x7FF
-void CAN_Controller::addFilter(uint32_t address){
-    if(filterIndex == 0){
-        CAN0->init_Mask(0, 0x01FFC000); //this number is 0x7FF bit shifted left by 14. This only allows standard CANBUS IDs
-        CAN0->init_Mask(1, 0x01FFC000); //the first number is the choise of mask (0-5)
+/// @brief Initializes the MCP2515 CAN bus controller and services it from its INT pin. Received frames are moved out of the two MCP2515 receive buffers
+/// as soon as they arrive and held in a ring until receive() is called, so a slow loop() no longer drops frames. Queued transmit frames are loaded
+/// from the transmit-complete interrupt.
+/// @param baudRate Baud rate in bits per second.
+/// @param chipSelectPin Pin connected to the MCP2515 chip select.
+/// @param interruptPin Pin connected to the MCP2515 INT output (active low).
+void CAN_Controller::begin(unsigned long baudRate, uint8_t chipSelectPin, uint8_t interruptPin){
+    begin(baudRate, chipSelectPin);
+    intPin = interruptPin;
+    rxRing.clear();
+    pinMode(intPin, INPUT_PULLUP);
+    lockSPI();
+    enableInterrupts();
+    attachInterrupt(intPin, &CAN_Controller::interruptHandler, this, FALLING);
+    interruptEnabled = true;
+    interruptPending = true;                    //Pick up anything that arrived before the interrupt was attached
+    unlockSPI();
+}
+
+/// @brief Returns the number of received frames dropped because the receive ring was full.
+uint32_t CAN_Controller::rxOverflowCount(){
+    return rxRing.overflowCount();
+}
+
+/// @brief [Internal Function] Interrupt handler for the MCP2515 INT pin. Services the MCP2515 unless loop code or another controller's interrupt is in the
+/// middle of an SPI transaction.
+void CAN_Controller::interruptHandler(){
+    if(!interruptEnabled) return;               //autoDetectBaud is reading the chip directly
+    if(spiLockDepth){                           //Can't touch SPI right now, unlockSPI() will service the MCP2515 once the current holder is done
+        interruptPending = true;
+        return;
     }
-    if(filterIndex < 6){                              //the MCP only has 6 total filters (6 hex IDs it can accept messages from)
-        CAN0->init_Filt(filterIndex, 0, address<<16); //this tells the MCP to only accept messages matching an ID (address bit shifted by 16)
-        filterIndex++;
+    lockSPI();
+    serviceInterrupt();
+    unlockSPI();                                //Runs any other controller's interrupt that was deferred while this one held the bus
+}
+
+/// @brief [Internal Function] Handles every pending MCP2515 interrupt source: acknowledges transmit-complete and loads the next queued frame, then drains the receive buffers.
+void CAN_Controller::serviceInterrupt(){
+    uint8_t status = mcpReadStatus();
+    if(status & (MCP2515_STATUS_TX0IF | MCP2515_STATUS_TX1IF | MCP2515_STATUS_TX2IF)){
+        collectTxCompletions(status);
+        serviceTxQueue();
+    }
+    if(status & (MCP2515_STATUS_RX0IF | MCP2515_STATUS_RX1IF)) drainReceiveBuffers();
+}
+
+/// @brief [Internal Function] Stamps the frames in every transmit buffer the MCP2515 flags as sent and clears those flags. Called from the
+/// interrupt, or from serviceTxQueue when running without an INT pin.
+/// @param status Result of READ STATUS.
+void CAN_Controller::collectTxCompletions(uint8_t status){
+    static const uint8_t txDoneBits[3] = {MCP2515_STATUS_TX0IF, MCP2515_STATUS_TX1IF, MCP2515_STATUS_TX2IF};
+    uint8_t clearMask = 0;
+    for(uint8_t buf = 0; buf < 3; buf++){
+        if(!(status & txDoneBits[buf])) continue;
+        recordTxComplete(txInFlight[buf]);
+        clearMask |= MCP2515_INT_TX0 << buf;
+    }
+    if(clearMask) mcpBitModify(MCP2515_REG_CANINTF, clearMask, 0);   //Must be cleared or INT stays asserted and no further edges arrive
+}
+
+/// @brief [Internal Function] Enables the transmit-complete interrupts on top of the receive interrupts the MCP_CAN library turns on. Must be redone after CAN0->begin().
+void CAN_Controller::enableInterrupts(){
+    mcpBitModify(MCP2515_REG_CANINTE, MCP2515_INT_TX_ALL, MCP2515_INT_TX_ALL);
+}
+
+/// @brief [Internal Function] Moves every frame waiting in the MCP2515 receive buffers into the receive ring. Frames are read straight into their ring slot.
+void CAN_Controller::drainReceiveBuffers(){
+    for(uint8_t i = 0; i < CAN_RX_RING_SIZE; i++){
+        LV_CANMessage *slot = rxRing.reserve();
+        if(slot == NULL){                                   //Ring is full, still have to empty the MCP2515 or INT stays asserted
+            LV_CANMessage overflow;
+            if(!readFrame(overflow)) return;
+            if(acceptsId(overflow.addr)) rxRing.push(overflow);    //Fails and counts the overflow. Filtered-out frames aren't a loss.
+            continue;
+        }
+        if(!readFrame(*slot)) return;
+        if(!acceptsId(slot->addr)) continue;
+        rxRing.commit();
+    }
+}
+
+/// @brief [Internal Function] Reads one frame out of the MCP2515 receive buffers with READ STATUS and READ RX BUFFER, two chip select assertions
+/// per frame. READ RX BUFFER also clears the buffer's receive flag, so no BIT MODIFY is needed. The SPI bus must already be held with lockSPI()
+/// or be in the interrupt.
+/// @param msg Populated with the frame read from the MCP2515 (returns reference).
+/// @return True if a frame was taken out of the MCP2515, false if both receive buffers were empty.
+bool CAN_Controller::readFrame(LV_CANMessage &msg){
+    uint8_t status = mcpReadStatus();
+    uint8_t instruction;
+    if(status & MCP2515_STATUS_RX0IF) instruction = MCP2515_INSTR_READ_RX;
+    else if(status & MCP2515_STATUS_RX1IF) instruction = MCP2515_INSTR_READ_RX | 0x04;
+    else return false;
+    uint8_t header[5];                              //SIDH, SIDL, EID8, EID0, DLC
+    mcpSelect();
+    SPI.transfer(instruction);
+    for(uint8_t i = 0; i < 5; i++) header[i] = SPI.transfer(0x00);
+    uint8_t len = header[4] & 0x0F;
+    if(len > 8) len = 8;
+    mcpTransferBytes(NULL, msg.data(), len);        //Straight into the caller's frame, and only the bytes the frame carries
+    mcpDeselect();
+    memset(msg.data() + len, 0, 8 - len);           //Bytes past len are not read, keep them zero
+    msg.extended = (header[1] & MCP2515_SIDL_EXIDE) != 0;
+    if(msg.extended){
+        msg.addr = ((uint32_t)header[0] << 21) | ((uint32_t)(header[1] & 0xE0) << 13) | ((uint32_t)(header[1] & 0x03) << 16) | ((uint32_t)header[2] << 8) | header[3];
+    }
+    else{
+        msg.addr = ((uint32_t)header[0] << 3) | (header[1] >> 5);
     }
+    msg.len = len;
+    msg.rxTimestampUs = micros();                   //In the interrupt when an INT pin is used, so this is within microseconds of arrival
+    recordFrame(false, msg.len, msg.extended);
+    return true;
+}
+
+/// @brief Chooses between pipelined transmit, where all three MCP2515 transmit buffers are loaded at once and the MCP2515 picks the order from
+/// their TXP priority bits, and ordered transmit, where only TXB0 is used so frames leave exactly in queue order.
+/// @param enabled True to use all three transmit buffers (default).
+void CAN_Controller::setTxPipelining(bool enabled){
+    lockSPI();
+    txPipelined = enabled;
+    unlockSPI();
+}
+
+/// @brief [Internal Function] Maps a CAN ID to the MCP2515 TXP priority bits. The top two ID bits pick one of the four levels so lower IDs,
+/// which would win bus arbitration, also win inside the MCP2515.
+/// @return Priority from 0 (lowest) to 3 (highest).
+static uint8_t mcpTxPriority(const LV_CANMessage &msg){
+    return 3 - (canArbitrationKey(msg) >> 27);
+}
+
+/// @brief [Internal Function] Loads queued frames into every free transmit buffer and starts them with a single RTS. Among buffers with the same
+/// TXP, the MCP2515 sends the highest numbered buffer first, so buffers are filled from TXB2 down. A frame is held back while another frame with
+/// the same ID is still waiting in a buffer so frames on one ID never swap. The SPI bus must already be held with lockSPI() or be in the interrupt.
+/// @return True if at least one frame was loaded.
+bool CAN_Controller::serviceTxQueue(){
+    if(txQueue.count() == 0 || txHeld) return false;
+    static const uint8_t txReqBits[3] = {MCP2515_STATUS_TX0REQ, MCP2515_STATUS_TX1REQ, MCP2515_STATUS_TX2REQ};
+    uint8_t status = mcpReadStatus();
+    if(!interruptEnabled) collectTxCompletions(status);        //Nobody else is watching the transmit-complete flags
+    uint8_t rtsMask = 0;
+    LV_CANMessage txMessage;
+    for(int8_t buf = txPipelined ? 2 : 0; buf >= 0; buf--){
+        if(status & txReqBits[buf]) continue;                       //Buffer still waiting for the bus
+        if(!txQueue.peek(txMessage)) break;
+        bool idInFlight = false;
+        for(uint8_t other = 0; other < 3; other++){
+            if((status & txReqBits[other]) && txInFlight[other].addr == txMessage.addr) idInFlight = true;
+        }
+        if(idInFlight) break;                                       //Wait for the earlier frame on this ID to go out first
+        txQueue.pop(txMessage);
+        loadTxBuffer(buf, txMessage, txPipelined ? mcpTxPriority(txMessage) : 0);
+        recordFrame(true, txMessage.len, txMessage.extended);
+        txInFlight[buf] = txMessage;
+        rtsMask |= 1 << buf;
+    }
+    if(rtsMask == 0) return false;
+    mcpRequestToSend(rtsMask);
+    return true;
+}
+
+/// @brief [Internal Function] Writes the priority, ID, length and data of a frame into one of the MCP2515 transmit buffers in a single SPI transaction.
+/// Only the bytes up to the frame's length are written. When the buffer already has the right priority, LOAD TX BUFFER is used so TXBnCTRL and the
+/// register address are skipped. Does not request transmission.
+/// @param bufferIndex Transmit buffer to load (0-2).
+/// @param msg The frame to load.
+/// @param priority TXP bits (0-3) written to TXBnCTRL.
+void CAN_Controller::loadTxBuffer(uint8_t bufferIndex, const LV_CANMessage &msg, uint8_t priority){
+    uint8_t len = msg.len > 8 ? 8 : msg.len;
+    uint8_t regs[14] = {
+        (uint8_t)(priority & 0x03),                                         //TXBnCTRL, TXREQ stays clear until the RTS
+        0, 0, 0, 0,                                                         //SIDH, SIDL, EID8, EID0
+        len,                                                                //DLC
+        msg.byte0, msg.byte1, msg.byte2, msg.byte3, msg.byte4, msg.byte5, msg.byte6, msg.byte7
+    };
+    if(msg.extended){
+        regs[1] = (uint8_t)(msg.addr >> 21);
+        regs[2] = (uint8_t)(((msg.addr >> 13) & 0xE0) | MCP2515_SIDL_EXIDE | ((msg.addr >> 16) & 0x03));
+        regs[3] = (uint8_t)(msg.addr >> 8);
+        regs[4] = (uint8_t)msg.addr;
+    }
+    else{
+        regs[1] = (uint8_t)(msg.addr >> 3);
+        regs[2] = (uint8_t)((msg.addr & 0x07) << 5);
+    }
+    if(txBufferPriority[bufferIndex] == priority){
+        mcpSelect();
+        SPI.transfer(MCP2515_INSTR_LOAD_TX | (bufferIndex << 1));
+        mcpTransferBytes(regs + 1, NULL, 5 + len);
+        mcpDeselect();
+        return;
+    }
+    mcpWriteRegisters(MCP2515_REG_TXB0CTRL + (bufferIndex << 4), regs, 6 + len);
+    txBufferPriority[bufferIndex] = priority;
+}
+
+/// @brief Moves the next queued frame into the MCP2515 if it has room. Called from CANSend and receive, but can also be called from loop() to keep the queue moving
+/// when no interrupt pin is used.
+void CAN_Controller::serviceTx(){
+    updateBusHealth();
+    if(txQueue.count() == 0 || txHeld) return;
+    lockSPI();
+    serviceTxQueue();
+    unlockSPI();
+}
+
+/// @brief [Internal Function] Marks the SPI bus as in use so the MCP2515 interrupt defers its work. Nests: the bus is only released by the
+/// matching outermost unlockSPI(). An interrupt arriving mid-increment always puts the depth back before returning, so no masking is needed here.
+void CAN_Controller::lockSPI(){
+    spiLockDepth++;
+}
+
+/// @brief [Internal Function] Releases the SPI bus and performs any interrupt work that had to be deferred while it was held, on every controller
+/// sharing the bus. Each pass services every pending controller once (at most two received frames each), so a flooded bus can't starve the others.
+/// The last check for deferred work and the release happen with interrupts masked. Otherwise an INT edge landing between them would be deferred
+/// with nobody left to service it, and since INT stays low no new edge would come.
+void CAN_Controller::unlockSPI(){
+    if(spiLockDepth > 1){                       //Nested, the outermost unlock does the deferred work
+        spiLockDepth--;
+        return;
+    }
+    while(true){
+        bool serviced = false;
+        for(uint8_t i = 0; i < controllerCount; i++){
+            CAN_Controller *controller = controllers[(nextServiced + i) % controllerCount];
+            if(!controller->interruptEnabled || !controller->interruptPending) continue;
+            controller->interruptPending = false;
+            controller->serviceInterrupt();
+            serviced = true;
+        }
+        if(serviced){
+            nextServiced = (nextServiced + 1) % controllerCount;
+            continue;
+        }
+        noInterrupts();
+        bool pending = false;
+        for(uint8_t i = 0; i < controllerCount; i++) pending |= controllers[i]->interruptEnabled && controllers[i]->interruptPending;
+        if(!pending) spiLockDepth = 0;
+        interrupts();
+        if(!pending) return;
+    }
+}
+
+/// @brief [Internal Function] Adds this controller to the list serviced by unlockSPI(), once.
+void CAN_Controller::registerController(){
+    for(uint8_t i = 0; i < controllerCount; i++){
+        if(controllers[i] == this) return;
+    }
+    if(controllerCount < CAN_MAX_CONTROLLERS) controllers[controllerCount++] = this;
+}
+
+/// @brief [Internal Function] Asserts the MCP2515 chip select for a direct register transaction.
+void CAN_Controller::mcpSelect(){
+    SPI.beginTransaction(SPISettings(8000000, MSBFIRST, SPI_MODE0));
+    digitalWrite(csPin, LOW);
+}
+
+/// @brief [Internal Function] Releases the MCP2515 chip select, ending the transaction.
+void CAN_Controller::mcpDeselect(){
+    digitalWrite(csPin, HIGH);
+    SPI.endTransaction();
+}
+
+/// @brief [Internal Function] Issues the READ STATUS instruction, which returns the receive flags and transmit request/complete flags in one byte.
+uint8_t CAN_Controller::mcpReadStatus(){
+    mcpSelect();
+    SPI.transfer(MCP2515_INSTR_READ_STATUS);
+    uint8_t status = SPI.transfer(0x00);
+    mcpDeselect();
+    return status;
+}
+
+/// @brief [Internal Function] Reads consecutive MCP2515 registers in one chip select assertion.
+void CAN_Controller::mcpReadRegisters(uint8_t address, uint8_t *values, uint8_t count){
+    mcpSelect();
+    SPI.transfer(MCP2515_INSTR_READ);
+    SPI.transfer(address);
+    mcpTransferBytes(NULL, values, count);
+    mcpDeselect();
+}
+
+/// @brief [Internal Function] Clocks count bytes while the chip select is already asserted. Uses the DMA form of SPI.transfer for loop code when
+/// MCP2515_SPI_DMA is set. Interrupt code always goes byte by byte, since a blocking DMA transfer waits on an interrupt of its own.
+/// @param tx Bytes to send, or NULL to send zeros.
+/// @param rx Where to store the bytes received, or NULL to throw them away.
+void CAN_Controller::mcpTransferBytes(const uint8_t *tx, uint8_t *rx, uint8_t count){
+    if(count == 0) return;
+    #if MCP2515_SPI_DMA
+    if(!HAL_IsISR()){
+        SPI.transfer((void *)tx, rx, count, NULL);     //NULL callback makes the transfer blocking
+        return;
+    }
+    #endif
+    for(uint8_t i = 0; i < count; i++){
+        uint8_t value = SPI.transfer(tx != NULL ? tx[i] : 0x00);
+        if(rx != NULL) rx[i] = value;
+    }
+}
+
+/// @brief [Internal Function] Restarts the MCP2515 after bus-off. Pending transmissions are aborted, then the chip is reset, which clears TEC/REC,
+/// and the mode, filters and interrupts are set up again.
+void CAN_Controller::restartController(){
+    lockSPI();
+    CAN0->abortTX();
+    CAN0->begin(MCP_STDEXT, currentBaudRate, MCP_8MHZ);
+    CAN0->setMode(MCP_NORMAL);
+    memset(txBufferPriority, 0, sizeof(txBufferPriority));
+    if(interruptEnabled) enableInterrupts();
+    unlockSPI();
+    if(acceptedIdCount) applyFilterPlan();
+}
+
+/// @brief [Internal Function] Reads TEC, REC and EFLG from the MCP2515 in two short SPI transactions.
+void CAN_Controller::sampleErrorCounters(CAN_BusStats &stats){
+    uint8_t counters[2];
+    uint8_t eflg;
+    lockSPI();
+    mcpReadRegisters(MCP2515_REG_TEC, counters, 2);
+    mcpReadRegisters(MCP2515_REG_EFLG, &eflg, 1);
+    unlockSPI();
+    stats.txErrorCount = counters[0];
+    stats.rxErrorCount = counters[1];
+    if(eflg & MCP2515_EFLG_TXBO) stats.errorState = CAN_STATE_BUS_OFF;
+    else if(eflg & (MCP2515_EFLG_TXEP | MCP2515_EFLG_RXEP)) stats.errorState = CAN_STATE_ERROR_PASSIVE;
+    else stats.errorState = CAN_STATE_ERROR_ACTIVE;
+}
+
+/// @brief [Internal Function] Writes consecutive MCP2515 registers in one chip select assertion.
+void CAN_Controller::mcpWriteRegisters(uint8_t address, const uint8_t *values, uint8_t count){
+    mcpSelect();
+    SPI.transfer(MCP2515_INSTR_WRITE);
+    SPI.transfer(address);
+    mcpTransferBytes(values, NULL, count);
+    mcpDeselect();
+}
+
+/// @brief [Internal Function] Changes only the masked bits of an MCP2515 register.
+void CAN_Controller::mcpBitModify(uint8_t address, uint8_t mask, uint8_t value){
+    mcpSelect();
+    SPI.transfer(MCP2515_INSTR_BIT_MODIFY);
+    SPI.transfer(address);
+    SPI.transfer(mask);
+    SPI.transfer(value);
+    mcpDeselect();
+}
+
+/// @brief [Internal Function] Requests transmission of the loaded transmit buffers.
+/// @param bufferMask Bit 0 for TXB0, bit 1 for TXB1, bit 2 for TXB2.
+void CAN_Controller::mcpRequestToSend(uint8_t bufferMask){
+    mcpSelect();
+    SPI.transfer(MCP2515_INSTR_RTS | (bufferMask & 0x07));
+    mcpDeselect();
+}
+
+/// @brief [Internal Function] Loads currentFilterPlan into the MCP2515 masks and filters. Filters 0-1 use RXM0 and filters 2-5 use RXM1.
+void CAN_Controller::applyFilterPlan(){
+    lockSPI();
+    CAN0->init_Mask(0, 0, (uint32_t)currentFilterPlan.filterMasks[0] << 16);   //Standard ID sits in the upper 16 bits, the lower 16 would also mask the first two data bytes
+    CAN0->init_Mask(1, 0, (uint32_t)currentFilterPlan.filterMasks[2] << 16);
+    for(uint8_t f = 0; f < 6; f++){
+        CAN0->init_Filt(f, 0, (uint32_t)currentFilterPlan.filterIds[f] << 16);
+    }
+    unlockSPI();
 }
 
 /// @brief Checks if a message was received on CAN bus and populates the LV_CANMessage with the received data. Do 'LV_CANMessage message;' then 'controller.receive(message);'.
+/// When an interrupt pin was given to begin(), this is a dequeue from the receive ring and does no SPI traffic.
 /// @param outputMessage CAN bus message that will be returned by the CAN controller (returns reference). 
 /// @return Boolean indicating whether or not a message was received from the CAN bus
 bool CAN_Controller::receive(LV_CANMessage &outputMessage){
-    bool receivedMessage = CAN0->checkReceive();
-    if(!receivedMessage) return receivedMessage;
-    uint32_t rxId = 0;
-    unsigned char len = 0;
-    unsigned char rxBuf[8];
-    CAN0->readMsgBuf(&rxId, &len, rxBuf);
-    if(rxId == 0) return false;
-    outputMessage.addr = rxId;
-    outputMessage.byte0 = rxBuf[0];
-    outputMessage.byte1 = rxBuf[1];
-    outputMessage.byte2 = rxBuf[2];
-    outputMessage.byte3 = rxBuf[3];
-    outputMessage.byte4 = rxBuf[4];
-    outputMessage.byte5 = rxBuf[5];
-    outputMessage.byte6 = rxBuf[6];
-    outputMessage.byte7 = rxBuf[7];
-    return true;
+    if(takePeekedFrame(outputMessage)) return true;     //A frame peeked but not released comes first
+    if(interruptEnabled){
+        ringPeeked = false;                             //A peeked ring slot is the oldest, so the pop below takes it
+        if(rxRing.pop(outputMessage)) return true;
+        if(digitalRead(intPin) == HIGH) return false;   //INT is idle, nothing waiting in the MCP2515 either
+        lockSPI();                                      //INT is still asserted but the ring is empty, we missed an edge. Service it by hand.
+        serviceInterrupt();
+        unlockSPI();
+        return rxRing.pop(outputMessage);
+    }
+    lockSPI();
+    serviceTxQueue();                                   //Opportunistically keep the transmit queue moving
+    bool receivedMessage = false;
+    while(readFrame(outputMessage)){
+        if(!acceptsId(outputMessage.addr)) continue;     //Ignore frames with no address or that got past the hardware filters
+        receivedMessage = true;
+        break;
+    }
+    unlockSPI();
+    return receivedMessage;
+}
+
+/// @brief Returns the next received frame without copying it into caller storage. With an interrupt pin, this points straight into the receive ring.
+/// The frame stays valid until releaseReceive(). Example: 'const LV_CANMessage *msg = controller.peekReceive(); if(msg){ dc.receiveCANData(*msg); controller.releaseReceive(); }'
+/// @return Pointer to the frame, or NULL if nothing was received.
+const LV_CANMessage *CAN_Controller::peekReceive(){
+    if(peekValid) return &peekSlot;
+    if(!interruptEnabled){
+        peekValid = receive(peekSlot);
+        return peekValid ? &peekSlot : NULL;
+    }
+    const LV_CANMessage *msg = rxRing.peek();
+    if(msg == NULL && digitalRead(intPin) == LOW){
+        lockSPI();                                      //INT is still asserted but the ring is empty, we missed an edge
+        serviceInterrupt();
+        unlockSPI();
+        msg = rxRing.peek();
+    }
+    ringPeeked = msg != NULL;
+    return msg;
+}
+
+/// @brief Frees the frame returned by peekReceive() so its ring slot can be reused.
+void CAN_Controller::releaseReceive(){
+    if(peekValid) peekValid = false;
+    else if(ringPeeked){                                //Only a slot that was peeked and not already taken by receive()
+        ringPeeked = false;
+        rxRing.release();
+    }
+}
+
+/// @brief Pulls every frame waiting in the CAN controller in one call. Use this instead of calling receive() in a loop when a burst of frames is expected.
+/// Without an interrupt pin, this holds the SPI bus once for the whole burst instead of once per frame.
+/// @param outputMessages Array of LV_CANMessage to populate with the received frames (returns reference).
+/// @param maxMessages Number of elements in outputMessages.
+/// @return Number of frames written to outputMessages.
+size_t CAN_Controller::receiveBatch(LV_CANMessage *outputMessages, size_t maxMessages){
+    size_t received = 0;
+    if(received < maxMessages && takePeekedFrame(outputMessages[received])) received++;     //A frame peeked but not released comes first
+    if(interruptEnabled){
+        if(received < maxMessages) ringPeeked = false;  //A peeked ring slot is the oldest, so the first pop takes it
+        while(received < maxMessages && rxRing.pop(outputMessages[received])) received++;
+        if(received == maxMessages || digitalRead(intPin) == HIGH) return received;
+        lockSPI();                                      //INT is still asserted, top the ring up before returning
+        serviceInterrupt();
+        unlockSPI();
+        while(received < maxMessages && rxRing.pop(outputMessages[received])) received++;
+        return received;
+    }
+    lockSPI();
+    serviceTxQueue();
+    while(received < maxMessages && readFrame(outputMessages[received])){
+        if(acceptsId(outputMessages[received].addr)) received++;
+    }
+    unlockSPI();
+    return received;
 }
 
 /// @brief Reinitializes the CAN controller with a new CAN Bus baud rate.
 /// @param newCanSpeed New CAN Bus speed in bps. 
 void CAN_Controller::changeCANSpeed(uint32_t newCanSpeed){
+    lockSPI();
     currentBaudRate = convertBaudRateToMCP(newCanSpeed);
-    CAN0->begin(MCP_STDEXT, currentBaudRate, csPin);
+    CAN0->begin(MCP_STDEXT, currentBaudRate, MCP_8MHZ);
+    CAN0->setMode(MCP_NORMAL);
+    memset(txBufferPriority, 0, sizeof(txBufferPriority));
+    if(interruptEnabled){
+        enableInterrupts();
+        interruptPending = true;                    //INT may already be low from a frame that arrived during begin(), that edge is gone
+    }
+    unlockSPI();
+    if(acceptedIdCount) applyFilterPlan();          //begin() clears the masks and filters
+    if(sniffing) setSnifferMode(true);              //begin() also left listen-only mode
+}
+
+/// @brief Turns sniffer mode on or off. In sniffer mode the MCP2515 is put in listen-only mode, so it never acknowledges a frame or sends an error frame,
+/// and its receive buffers take every frame on the bus, including extended and ID 0 frames. CANSend returns CAN_TX_SUPPRESSED while sniffing.
+/// @param enabled True to start sniffing, false to go back to normal mode and the filters set with setAcceptedIds/addFilter.
+void CAN_Controller::setSnifferMode(bool enabled){
+    lockSPI();
+    sniffing = enabled;
+    CAN0->setMode(enabled ? MCP_LISTENONLY : MCP_NORMAL);
+    uint8_t rxMode = enabled ? MCP2515_RXM_ANY : 0;          //Masks and filters off, or back on
+    mcpBitModify(MCP2515_REG_RXB0CTRL, MCP2515_RXM_ANY, rxMode);
+    mcpBitModify(MCP2515_REG_RXB1CTRL, MCP2515_RXM_ANY, rxMode);
+    unlockSPI();
+}
+
+/// @brief [Internal Function] Restarts the MCP2515 at a candidate rate for autoDetectBaud in listen-only mode, with every filter open.
+void CAN_Controller::startListening(uint32_t bitsPerSecond){
+    lockSPI();
+    CAN0->begin(MCP_STDEXT, convertBaudRateToMCP(bitsPerSecond), MCP_8MHZ);   //Masks cleared, everything accepted
+    CAN0->setMode(MCP_LISTENONLY);
+    mcpBitModify(MCP2515_REG_CANINTF, MCP2515_INT_MERR, 0);
+    unlockSPI();
+}
+
+/// @brief [Internal Function] Reads the frames waiting in the MCP2515 and checks the message error flag, for autoDetectBaud.
+/// @param frames Incremented for every frame received (returns reference).
+/// @param errors Incremented when the MCP2515 flagged a malformed frame since the last call (returns reference).
+void CAN_Controller::listenForFrames(uint16_t &frames, uint16_t &errors){
+    LV_CANMessage msg;
+    uint8_t intf;
+    lockSPI();
+    while(readFrame(msg)) frames++;
+    mcpReadRegisters(MCP2515_REG_CANINTF, &intf, 1);
+    if(intf & MCP2515_INT_MERR){
+        errors++;
+        mcpBitModify(MCP2515_REG_CANINTF, MCP2515_INT_MERR, 0);
+    }
+    unlockSPI();
 }
 
 /// @brief Returns the current baud rate of the CAN controller
@@ -681,27 +2495,21 @@ uint32_t CAN_Controller::CurrentBaudRate(){
     return currentBaudRate;
 }
 
-/// @brief [Internal Function] Manually sends a CAN bus packet using the CAN bus controller on the address specified with the inputted data. Example: 'CANSend(0x100, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08);' transmits on address 0x100 with the data [1,2,3,4,5,6,7,8]
-/// @param Can_addr CAN Bus address to transmit on
-/// @param data0 CAN Bus Data 0 field (8 bits)
-/// @param data1 CAN Bus Data 1 field (8 bits)
-/// @param data2 CAN Bus Data 2 field (8 bits)
-/// @param data3 CAN Bus Data 3 field (8 bits)
-/// @param data4 CAN Bus Data 4 field (8 bits)
-/// @param data5 CAN Bus Data 5 field (8 bits)
-/// @param data6 CAN Bus Data 6 field (8 bits)
-/// @param data7 CAN Bus Data 7 field (8 bits)
-void CAN_Controller::CANSend(uint16_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7){    //Implementation of CANSend on boards 
-    byte data[8] = {data0, data1, data2, data3, data4, data5, data6, data7};
-    CAN0->sendMsgBuf(Can_addr, 0, 8, data);
-}
-
-/// @brief [Internal Function] Manually sends a CAN bus packet using the CAN bus controller on the address specified with the inputted data. Example: 'CANSend(0x100, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08);' transmits on address 0x100 with the data [1,2,3,4,5,6,7,8]
-/// @param Can_addr CAN Bus address to transmit on
+/// @brief Sends a CAN bus packet using the MCP2515. The frame is loaded straight into a transmit buffer if one is free, otherwise it waits in a
+/// priority-ordered transmit queue. Never busy-waits for the bus like MCP_CAN::sendMsgBuf.
 /// @param inMsg CAN Bus message class
-void CAN_Controller::CANSend(LV_CANMessage inMsg){    //Implementation of CANSend on boards 
-    byte data[8] = {inMsg.byte0, inMsg.byte1, inMsg.byte2, inMsg.byte3, inMsg.byte4, inMsg.byte5, inMsg.byte6, inMsg.byte7};
-    CAN0->sendMsgBuf(inMsg.addr, 0, 8, data);
+/// @return CAN_TX_SENT, CAN_TX_QUEUED or CAN_TX_DROPPED.
+uint8_t CAN_Controller::CANSend(LV_CANMessage inMsg){
+    updateBusHealth();
+    if(sniffing || (!healthy && inMsg.addr > recoveryPolicy.suppressAboveId)) return CAN_TX_SUPPRESSED;
+    lockSPI();
+    uint8_t result = CAN_TX_DROPPED;
+    if(txQueue.push(inMsg)){
+        result = CAN_TX_QUEUED;
+        if(txBurstDepth == 0 && serviceTxQueue() && txQueue.count() == 0) result = CAN_TX_SENT;    //Everything queued, this frame included, made it into the hardware
+    }
+    unlockSPI();
+    return result;
 }
 
 #endif
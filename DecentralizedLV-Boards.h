@@ -3,6 +3,7 @@
 
 #include "Particle.h"
 #include <mcp_can.h>
+#include <atomic>
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
 // MACROS FOR SYSTEM OPERATION
@@ -113,6 +114,7 @@
 // byte 5: 
 // byte 6: Drive Mode: b0: Drive, b1: Sport, b2: Eco, b3: Reverse, b4: Neutral (BPS fault)
 // byte 7: b0: Radiator Fan, b1: Radiator pump
+// The bit positions are defined once in DashController_CAN::Layout, which both sendCANData and receiveCANData use.
 // EXAMPLE FRAME: CANSend(0x99, 0xFF, 0xFF, 0x00, 0xFF, 0x03, 0x00, 0x01, 0x03);
 // - Right and Left turn signal, headlight, and highbeam are on (at full brightness for L and R signal)
 // - Car is not in low power mode, not doing startup animations
@@ -123,14 +125,15 @@
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //Power Controller CAN Message Format. UPDATE THIS WHEN YOU ADD FIELDS OR ADDITIONAL CAN DATA!
 #define POWER_CONTROL_ADDR   0x120
-// byte 0: 
-// byte 1: 
-// byte 2: 
+// byte 0: b0: BrakeSense b1: PushToStart b2: ACCharge b3: SolarCharge b4: Horn
+// byte 1: b0: Acc b1: Ign b2: FullStart b3: CarOn b4: StartUp
+// byte 2: b0: LowPowerMode b1: LowACCBattery b2: boardDetected (sender's own flag, receivers set boardDetected on any frame)
 // byte 3: 
 // byte 4:
 // byte 5:
 // byte 6:
 // byte 7: 
+// The bit positions are defined once in PowerController_CAN::Layout, which both sendCANData and receiveCANData use.
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -203,12 +206,12 @@
 #define RMS_MTR_TEMP_ADDR   0x117
 // byte 0: Motor RPM (upper 8 bits) (RPM increments, 1 RPM = 1 increment)
 // byte 1: Motor RPM (lower 8 bits) (RPM increments, 1 RPM = 1 increment)
-// byte 2: Commanded Torque (upper 8 bits) (0.1Nm increments, 1 Nm = 10 increments)
-// byte 3: Commanded Torque (lower 8 bits) (0.1Nm increments, 1 Nm = 10 increments)
-// byte 4: Motor Temperature C (upper 8 bits) (degrees C, signed, 0.1C increments)
-// byte 5: Motor Temperature C (lower 8 bits) (degrees C, signed, 0.1C increments)
-// byte 6: Inverter Temperature C (upper 8 bits) (degrees C, signed, 0.1C increments)
-// byte 7: Inverter Temperature C (lower 8 bits) (degrees C, signed, 0.1C increments)
+// byte 2: Motor Temperature C (upper 8 bits) (degrees C, signed, 0.1C increments)
+// byte 3: Motor Temperature C (lower 8 bits) (degrees C, signed, 0.1C increments)
+// byte 4: Inverter Temperature C (upper 8 bits) (degrees C, signed, 0.1C increments)
+// byte 5: Inverter Temperature C (lower 8 bits) (degrees C, signed, 0.1C increments)
+// byte 6: Commanded Torque (upper 8 bits) (0.1Nm increments, 1 Nm = 10 increments)
+// byte 7: Commanded Torque (lower 8 bits) (0.1Nm increments, 1 Nm = 10 increments)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -228,32 +231,24 @@
 //HV Controller CAN Message Format. UPDATE THIS WHEN YOU ADD FIELDS OR ADDITIONAL CAN DATA!
 #define HV_CONTROL_ADDR   0x130
 // byte 0: b0: Killswitch b1: BMSFault
-// byte 1: 
-// byte 2: 
-// byte 3: 
-// byte 4:
-// byte 5:
-// byte 6:
-// byte 7: 
+// Only byte 0 is sent. The bit positions are defined once in HVController_CAN::Layout.
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-//Power Controller CAN Message Format. UPDATE THIS WHEN YOU ADD FIELDS OR ADDITIONAL CAN DATA!
+//Rear Left Driver CAN Message Format. UPDATE THIS WHEN YOU ADD FIELDS OR ADDITIONAL CAN DATA!
 #define REAR_LEFT_DRIVER   0x95
-// byte 0: 
-// byte 1: 
-// byte 2: 
-// byte 3: 
-// byte 4:
-// byte 5:
-// byte 6:
-// byte 7: 
+// byte 0: b0: BMS fault input
+// byte 1: b0: Kill switch fault input
+// Only bytes 0 and 1 are sent. The bit positions are defined once in LPDRV_RearLeft_CAN::Layout.
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 
 
 
 
+#define CAN_LITTLE_ENDIAN   0       //Byte order for LV_CANMessage::getBits/setBits: byte0 is the least significant byte (Intel)
+#define CAN_BIG_ENDIAN      1       //Byte order for LV_CANMessage::getBits/setBits: byte0 is the most significant byte (Motorola), as used by the board encoders
+
 /// @brief Generic CAN bus message with address and data fields.
 class LV_CANMessage{
   public:
@@ -266,31 +261,580 @@ class LV_CANMessage{
   uint8_t byte5 = 0;
   uint8_t byte6 = 0;
   uint8_t byte7 = 0;
+  uint8_t len = 8;          //Number of data bytes in this message (0-8). Bytes past len are zero on received messages and are not sent.
+  bool extended = false;    //True if addr is a 29-bit extended ID, false for an 11-bit standard ID
+  uint32_t rxTimestampUs = 0;   //micros() when the frame was pulled out of the CAN controller (in the interrupt on the MCP2515 with an INT pin). 0 for frames built locally.
+  uint32_t txTimestampUs = 0;   //micros() when the CAN controller reported the frame sent (handed to the CANChannel on the Photon). Filled in on frames returned by CAN_Controller::lastTransmitted.
+  uint32_t receivedAtUs() const { return rxTimestampUs ? rxTimestampUs : micros(); }   //rxTimestampUs, or now for frames built locally, which have none
+  uint8_t *data(){ return &byte0; }                 //The 8 data bytes as an array, for decoders that take a byte pointer
+  const uint8_t *data() const { return &byte0; }
+  uint64_t payload() const { uint64_t value; memcpy(&value, &byte0, 8); return value; }    //The 8 data bytes as one little-endian integer, byte0 in the low 8 bits. One load on both (little-endian) targets.
+  void setPayload(uint64_t value){ memcpy(&byte0, &value, 8); }                            //Sets all 8 data bytes, byte0 from the low 8 bits. Does not change len.
+  uint64_t payloadBE() const { return __builtin_bswap64(payload()); }                     //The 8 data bytes as one big-endian integer, byte0 in the high 8 bits
+  void setPayloadBE(uint64_t value){ setPayload(__builtin_bswap64(value)); }
+  /// Reads Length bits starting at bit Start of the payload word, where bit 0 is the least significant bit of the word: bit 0 of byte0 for
+  /// CAN_LITTLE_ENDIAN and bit 0 of byte7 for CAN_BIG_ENDIAN. Example: '(msg.byte0 << 8 | msg.byte1)' is 'msg.getBits<48, 16, CAN_BIG_ENDIAN>()'.
+  template <uint8_t Start, uint8_t Length, uint8_t Endian = CAN_LITTLE_ENDIAN> uint64_t getBits() const {
+    static_assert(Length > 0 && Start + Length <= 64, "Field must fit in the 64 bit payload");
+    uint64_t word = Endian == CAN_BIG_ENDIAN ? payloadBE() : payload();
+    return (word >> Start) & (Length == 64 ? ~0ULL : (1ULL << (Length & 63)) - 1);
+  }
+  /// Writes the low Length bits of value at bit Start of the payload word, leaving every other bit alone. Bits are numbered as in getBits.
+  template <uint8_t Start, uint8_t Length, uint8_t Endian = CAN_LITTLE_ENDIAN> void setBits(uint64_t value){
+    static_assert(Length > 0 && Start + Length <= 64, "Field must fit in the 64 bit payload");
+    const uint64_t mask = (Length == 64 ? ~0ULL : (1ULL << (Length & 63)) - 1) << Start;
+    if(Endian == CAN_BIG_ENDIAN) setPayloadBE((payloadBE() & ~mask) | ((value << Start) & mask));
+    else setPayload((payload() & ~mask) | ((value << Start) & mask));
+  }
   void update(uint32_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7);
 };
 
+/// @brief Compile-time description of one signal in a board's CAN frame: which member of Board it holds, and which bits of the payload word it occupies
+/// (numbered as in LV_CANMessage::getBits). Used as an entry of a CANLayout; use the CAN_SIGNAL macro instead of spelling out the member type.
+/// Members are copied bit for bit, so a signed member must be as wide as its signal.
+template <class Board, class T, T Board::*Member, uint8_t Start, uint8_t Length, uint8_t Endian = CAN_LITTLE_ENDIAN>
+struct CANSignal{
+    static_assert(Length > 0 && Start + Length <= 64, "Signal must fit in the 64 bit payload");
+    static constexpr uint64_t mask = Length == 64 ? ~0ULL : (1ULL << (Length & 63)) - 1;
+    static constexpr uint8_t lastByte = Endian == CAN_BIG_ENDIAN ? 7 - Start / 8 : (Start + Length - 1) / 8;   //Highest data byte the signal touches
+    static void pack(const Board &board, uint64_t &littleWord, uint64_t &bigWord){
+        uint64_t bits = ((uint64_t)(board.*Member) & mask) << Start;
+        if(Endian == CAN_BIG_ENDIAN) bigWord |= bits;
+        else littleWord |= bits;
+    }
+    static void unpack(Board &board, uint64_t littleWord, uint64_t bigWord){
+        board.*Member = (T)(((Endian == CAN_BIG_ENDIAN ? bigWord : littleWord) >> Start) & mask);
+    }
+};
+
+#define CAN_SIGNAL(Board, member, start, length)            CANSignal<Board, decltype(Board::member), &Board::member, start, length>
+#define CAN_SIGNAL_BE(Board, member, start, length)         CANSignal<Board, decltype(Board::member), &Board::member, start, length, CAN_BIG_ENDIAN>
+
+/// @brief The wire format of a board's frame, written once and used for both sending and receiving. pack() and unpack() expand at compile time into
+/// one shift and mask per signal on a 64 bit word, with no tables at runtime. Example, for a frame whose byte 0 holds flagA in bit 0 and whose byte 1 is count:
+/// 'typedef CANLayout<2, CAN_SIGNAL(MyBoard_CAN, flagA, 0, 1), CAN_SIGNAL(MyBoard_CAN, count, 8, 8)> Layout;' then 'Layout::pack(*this, msg);' and 'Layout::unpack(msg, *this);'
+template <uint8_t FrameLength, class... Signals>
+struct CANLayout{
+    static constexpr uint8_t length = FrameLength;          //Number of data bytes sent
+    static constexpr bool fitsInFrame(){
+        const uint8_t lastBytes[] = {0, Signals::lastByte...};
+        for(uint8_t b : lastBytes) if(b >= FrameLength) return false;
+        return true;
+    }
+    static_assert(FrameLength <= 8 && fitsInFrame(), "A signal lies past the end of the frame");
+    template <class Board> static void pack(const Board &board, LV_CANMessage &msg){     //Fills msg's data and len from board. Unused bits are zero.
+        uint64_t littleWord = 0;
+        uint64_t bigWord = 0;
+        int expand[] = {0, (Signals::pack(board, littleWord, bigWord), 0)...};
+        (void)expand;
+        msg.setPayload(littleWord | __builtin_bswap64(bigWord));
+        msg.len = FrameLength;
+    }
+    template <class Board> static void unpack(const LV_CANMessage &msg, Board &board){   //Copies every signal in msg into board
+        uint64_t littleWord = msg.payload();
+        uint64_t bigWord = msg.payloadBE();
+        int expand[] = {0, (Signals::unpack(board, littleWord, bigWord), 0)...};
+        (void)expand;
+    }
+};
+
+#define CAN_SEND_EVERY_CALL     0       //CAN_SendPolicy::heartbeatMs value that sends on every sendCANData call
+
+/// @brief Decides whether a board's sendCANData call actually puts a frame on the bus. With a heartbeat set, a frame goes out immediately when
+/// its data or length differ from the last one sent, and otherwise only once heartbeatMs has passed, so unchanged data stops loading the bus but
+/// receivers still hear from the board. Example: 'dc.sendPolicy.heartbeatMs = 100;' then call 'dc.sendCANData(canController);' as often as you like.
+class CAN_SendPolicy{
+    public:
+    uint16_t heartbeatMs = CAN_SEND_EVERY_CALL;     //Longest time between frames while nothing changes. CAN_SEND_EVERY_CALL sends every time.
+    bool shouldSend(const LV_CANMessage &msg);      //True if msg should be sent now. Records it as the last frame sent.
+    void sendFailed();                      //The frame shouldSend allowed was not sent (queue full or suppressed), send the next one regardless.
+    uint32_t skippedCount();                //Number of calls that did not send because nothing changed.
+
+    private:
+    uint64_t lastPayload = 0;
+    uint8_t lastLen = 0;
+    bool lastValid = false;
+    uint32_t lastSendMillis = 0;
+    uint32_t skipped = 0;
+};
+
 unsigned long convertBaudRateToParticle(unsigned long baudRate);
 unsigned long convertBaudRateToMCP(unsigned long baudRate);
 
+#define CAN_RX_RING_SIZE    32      //Number of frames the interrupt-driven receive ring can hold. Must be a power of two.
+
+/// @brief Lock-free single-producer/single-consumer ring of CAN frames. The MCP2515 interrupt fills it and CAN_Controller::receive empties it.
+class LV_CANRingBuffer{
+    public:
+    bool push(const LV_CANMessage &msg);    //Producer side (interrupt). Returns false and counts an overflow if the ring is full.
+    bool pop(LV_CANMessage &msg);           //Consumer side (loop). Returns false if there is nothing waiting.
+    uint16_t count();                       //Number of frames currently waiting in the ring.
+    uint32_t overflowCount();               //Number of frames dropped because the ring was full.
+    void clear();
+    LV_CANMessage *reserve();               //Producer side. Returns the next free slot to fill in place, or NULL if the ring is full. Publish it with commit().
+    void commit();                          //Producer side. Publishes the slot returned by reserve().
+    const LV_CANMessage *peek();            //Consumer side. Returns the oldest frame in place without copying, or NULL if empty. Free it with release().
+    void release();                         //Consumer side. Frees the slot returned by peek().
+
+    private:
+    LV_CANMessage slots[CAN_RX_RING_SIZE];
+    std::atomic<uint16_t> head{0};          //Free-running write index, only modified by the producer.
+    std::atomic<uint16_t> tail{0};          //Free-running read index, only modified by the consumer.
+    volatile uint32_t overflows = 0;
+};
+
+#define CAN_TX_QUEUE_SIZE   16      //Number of frames CAN_Controller can hold while waiting for the hardware to accept them.
+
+//Return values of CAN_Controller::CANSend
+#define CAN_TX_SENT         0       //Frame was handed straight to the CAN controller hardware.
+#define CAN_TX_QUEUED       1       //Hardware was busy, frame is waiting in the transmit queue and goes out as soon as a buffer frees up.
+#define CAN_TX_DROPPED      2       //Transmit queue was full of higher priority frames, frame was not sent.
+#define CAN_TX_SUPPRESSED   3       //Bus is unhealthy (error-passive or bus-off) and the frame is below the priority still allowed through, or the controller is in sniffer mode. Frame was not sent.
+
+/// @brief Bounded queue of frames waiting to be transmitted, ordered by CAN bus priority (lowest address first). Frames with the same address keep their order.
+class LV_CANTxQueue{
+    public:
+    bool push(const LV_CANMessage &msg);    //Returns false if the queue is full of higher priority frames. Evicts the lowest priority frame if msg outranks it.
+    bool peek(LV_CANMessage &msg);          //Copies the highest priority frame without removing it. Returns false if the queue is empty.
+    bool pop(LV_CANMessage &msg);           //Removes the highest priority frame. Returns false if the queue is empty.
+    uint8_t count();                        //Number of frames waiting.
+    uint32_t droppedCount();                //Number of frames dropped (rejected or evicted) because the queue was full.
+    void clear();
+    uint8_t removeBelowPriority(uint32_t addr);     //Drops every queued frame with a higher ID than addr. Returns the number removed.
+
+    private:
+    LV_CANMessage frames[CAN_TX_QUEUE_SIZE];    //Sorted lowest priority first, so the next frame to send is always at the end.
+    uint8_t frameCount = 0;
+    uint32_t dropped = 0;
+};
+
+//Values of CAN_BusStats::errorState
+#define CAN_STATE_ERROR_ACTIVE  0       //Normal operation, both error counters below 128.
+#define CAN_STATE_ERROR_PASSIVE 1       //TEC or REC at 128 or above. The controller still talks but can't flag errors on other nodes' frames.
+#define CAN_STATE_BUS_OFF       2       //TEC passed 255. The controller has stopped transmitting.
+
+/// @brief Snapshot of CAN bus traffic and error counters returned by CAN_Controller::busStats. Cheap to sample once per loop or per telemetry period.
+struct CAN_BusStats{
+    uint32_t txFrames;                  //Frames handed to the hardware for transmission since begin().
+    uint32_t rxFrames;                  //Frames read out of the hardware since begin(), including ones later thrown away by the software filter.
+    uint32_t txBytes;                   //Data bytes in txFrames.
+    uint32_t rxBytes;                   //Data bytes in rxFrames.
+    float busLoadPercent;               //Share of the bus taken by frames this controller sent or received since the previous busStats() call. Frames rejected by the hardware filters aren't seen, so this is a lower bound on total bus load.
+    uint8_t txErrorCount;               //Transmit error counter (TEC). Always 0 on the Photon, which doesn't expose it.
+    uint8_t rxErrorCount;               //Receive error counter (REC). Always 0 on the Photon, which doesn't expose it.
+    uint8_t errorState;                 //CAN_STATE_ERROR_ACTIVE, CAN_STATE_ERROR_PASSIVE or CAN_STATE_BUS_OFF.
+    uint16_t busOffEvents;              //Number of times the controller was seen entering bus-off.
+    uint16_t errorPassiveEvents;        //Number of times the controller was seen entering error-passive.
+    uint32_t droppedFrames;             //Frames lost because the transmit queue or receive ring was full.
+    void encode(uint32_t Can_addr, LV_CANMessage &msg);    //Packs the stats into one 8-byte frame so they can be sent on the LV bus
+};
+
+#define CAN_HEALTH_CHECK_MS             10      //How often CAN_Controller reads the controller's error state while sending
+#define CAN_DEFAULT_SUPPRESS_ABOVE_ID   0x1FF   //The LV board addresses all sit below this, most Camry cluster spoof frames sit above it
+
+/// @brief How CAN_Controller reacts when the bus goes bad. Pass to CAN_Controller::setRecoveryPolicy.
+struct CAN_RecoveryPolicy{
+    uint16_t initialBackoffMs = 10;                     //After going bus-off, transmission is held this long before the controller is restarted.
+    uint16_t maxBackoffMs = 1000;                       //Each bus-off in a row doubles the hold time, up to this limit.
+    uint16_t healthyHoldMs = 100;                       //The bus must stay error-active this long before it counts as healthy again and the backoff resets.
+    uint32_t suppressAboveId = CAN_DEFAULT_SUPPRESS_ABOVE_ID;  //While unhealthy, frames with a higher ID than this are not sent so critical frames get the bus first. 0x1FFFFFFF suppresses nothing.
+};
+
+#define CAN_TX_HISTORY_SIZE     8       //Number of recently sent frames CAN_Controller keeps for lastTransmitted()
+
+#define CAN_AUTOBAUD_LISTEN_MS  250     //Longest time CAN_Controller::autoDetectBaud listens at each speed, so detection takes at most 7x this
+#define CAN_AUTOBAUD_MIN_FRAMES 3       //Error-free frames autoDetectBaud needs to lock onto a speed early
+
+#define CAN_MAX_ACCEPTED_IDS    32      //Number of IDs that can be passed to CAN_Controller::setAcceptedIds or added with addFilter.
+#if PLATFORM_ID == PLATFORM_PHOTON_PRODUCTION
+#define CAN_MAX_HW_FILTERS      14      //The Photon's CAN peripheral has 14 filter banks, each with its own mask.
+#else
+#define CAN_MAX_HW_FILTERS      6       //The MCP2515 has 6 filters: filters 0-1 share mask RXM0 and filters 2-5 share mask RXM1.
+#define CAN_MAX_CONTROLLERS     4       //Number of MCP2515 CAN_Controllers that can share the SPI bus.
+#endif
+
+/// @brief Hardware acceptance filter settings computed by CAN_Controller::setAcceptedIds for a list of standard (11-bit) CAN IDs.
+struct CAN_FilterPlan{
+    uint8_t filterCount;                            //Number of hardware filters in use.
+    uint16_t filterIds[CAN_MAX_HW_FILTERS];         //ID each filter compares against.
+    uint16_t filterMasks[CAN_MAX_HW_FILTERS];       //Mask used by each filter. A 1 bit must match, a 0 bit is don't-care.
+    uint16_t acceptedIdCount;                       //Number of distinct IDs requested.
+    uint16_t skippedIdCount;                        //IDs left out of the plan: extended (29-bit) IDs, which the filters can't hold, and IDs past CAN_MAX_ACCEPTED_IDS.
+    uint16_t falseAccepts;                          //Number of standard IDs the hardware lets through that were not requested.
+    float softwareRejectRate;                       //Fraction of the IDs passed by the hardware that software has to throw away (assuming all IDs are equally busy).
+};
+
 /// @brief Class to handle CAN bus controllers (either onboard on Photon or using the MCP2515 on P2/other microcontrollers).
 class CAN_Controller{
     public:
     void addFilter(uint32_t address);
+    CAN_FilterPlan setAcceptedIds(const uint32_t *ids, size_t idCount);    //Replaces all filters with the best hardware filter settings for this list of IDs
+    CAN_FilterPlan filterPlan();            //Returns the filter settings currently loaded into the hardware
     bool receive(LV_CANMessage &outputMessage);
-    void CANSend(uint16_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7);
-    void CANSend(LV_CANMessage inputMessage);
+    size_t receiveBatch(LV_CANMessage *outputMessages, size_t maxMessages);
+    const LV_CANMessage *peekReceive();     //Returns the next received frame in place without copying it, or NULL if there is none. Call releaseReceive() when done with it.
+    void releaseReceive();                  //Frees the frame returned by peekReceive() so the next one can be read.
+    uint8_t CANSend(uint32_t Can_addr, byte data0, byte data1, byte data2, byte data3, byte data4, byte data5, byte data6, byte data7);
+    uint8_t CANSend(uint32_t Can_addr, const uint8_t *data, uint8_t len);  //Sends only len bytes, for short messages
+    uint8_t CANSend(LV_CANMessage inputMessage);
+    void serviceTx();                       //Moves queued frames into the hardware if it has room. Called automatically by CANSend and receive.
+    uint8_t txQueueDepth();                 //Number of frames waiting in the transmit queue.
+    uint32_t txDroppedCount();              //Number of frames dropped because the transmit queue was full.
+    bool lastTransmitted(uint32_t addr, LV_CANMessage &msg);   //Copies the most recently sent frame on addr, including its txTimestampUs. Returns false if none was sent recently.
+    CAN_BusStats busStats();                //Samples traffic counters, bus load and error state. Bus load is averaged since the previous call.
+    void setRecoveryPolicy(const CAN_RecoveryPolicy &policy);  //Changes the bus-off backoff and which frames are held back while the bus is unhealthy
+    bool busHealthy();                      //False while error-passive, bus-off, or recovering. Use to skip low priority periodic traffic.
+    void beginTxBurst();                    //Hold frames passed to CANSend in the transmit queue until endTxBurst(), so they are loaded into the hardware together.
+    void endTxBurst();                      //Loads the frames held since beginTxBurst() into the hardware. Bursts can be nested.
     void changeCANSpeed(uint32_t newCanSpeed);
+    void setSnifferMode(bool enabled);      //Receives every frame on the bus without acknowledging or sending anything (listen-only on the MCP2515)
+    uint32_t autoDetectBaud(uint16_t listenMs = CAN_AUTOBAUD_LISTEN_MS, uint8_t minFrames = CAN_AUTOBAUD_MIN_FRAMES);    //Listens at each supported speed and switches to the one the bus is running at. Returns it in bps, or 0 if none.
     uint32_t CurrentBaudRate();
     #if PLATFORM_ID == PLATFORM_PHOTON_PRODUCTION   //When running on a board with a photon, we'll use the internal controller, no need to specify chip select pin
     void begin(unsigned long baudRate);
     #else                                           //When running on a P2 or other, we need the MCP2515, which has a chip select pin you must specify.
     void begin(unsigned long baudRate, uint8_t chipSelectPin);
+    void begin(unsigned long baudRate, uint8_t chipSelectPin, uint8_t interruptPin);   //Same as above, but services the MCP2515 from its INT pin (receive ring and transmit-complete)
+    uint32_t rxOverflowCount();
+    void setTxPipelining(bool enabled);     //True (default) loads all three MCP2515 transmit buffers at once. False uses only TXB0 so frames leave strictly in queue order.
     #endif
     private:
-    MCP_CAN *CAN0;
-    uint8_t filterIndex;
+    MCP_CAN *CAN0 = NULL;
+    uint16_t acceptedIds[CAN_MAX_ACCEPTED_IDS];     //Sorted list of IDs requested by setAcceptedIds/addFilter
+    uint8_t acceptedIdCount;
+    CAN_FilterPlan currentFilterPlan;
+    void applyFilterPlan();
+    bool acceptsId(uint32_t addr);
     uint8_t csPin;
     uint32_t currentBaudRate;
+    LV_CANTxQueue txQueue;                  //Frames waiting for the hardware to have room
+    LV_CANMessage txHistory[CAN_TX_HISTORY_SIZE];  //Recently sent frames, stamped with txTimestampUs
+    uint8_t txHistoryNext;
+    void recordTxComplete(const LV_CANMessage &msg);
+    bool sniffing;                          //Set by setSnifferMode, disables transmit and the acceptance filters
+    LV_CANMessage peekSlot;                 //Frame held by peekReceive() when it isn't coming straight out of the receive ring
+    bool peekValid;
+    bool takePeekedFrame(LV_CANMessage &msg);
+    uint8_t txBurstDepth;                   //Nesting depth of beginTxBurst(), frames are only queued while non-zero
+    uint32_t txFrameCount;                  //Traffic counters reported by busStats()
+    uint32_t rxFrameCount;
+    uint32_t txByteCount;
+    uint32_t rxByteCount;
+    uint32_t busBitCount;                   //Bits of bus time used since the previous busStats() call
+    uint32_t lastStatsMillis;
+    uint8_t lastErrorState;
+    uint16_t busOffEvents;
+    uint16_t errorPassiveEvents;
+    CAN_RecoveryPolicy recoveryPolicy;
+    bool healthy;                           //Error-active for at least healthyHoldMs
+    bool txHeld;                            //Bus-off, transmission held until the backoff expires
+    uint16_t currentBackoffMs;
+    uint32_t backoffStartMillis;
+    uint32_t healthySinceMillis;
+    uint32_t lastHealthCheckMillis;
+    void resetBusStats();
+    void updateBusHealth();
+    void noteErrorState(uint8_t state);
+    void restartController();
+    void recordFrame(bool transmitted, uint8_t len, bool extended);
+    void sampleErrorCounters(CAN_BusStats &stats);
+    void startListening(uint32_t bitsPerSecond);
+    void listenForFrames(uint16_t &frames, uint16_t &errors);
+    #if PLATFORM_ID != PLATFORM_PHOTON_PRODUCTION
+    LV_CANRingBuffer rxRing;                //Frames pulled out of the MCP2515 by the interrupt, waiting for receive()
+    uint8_t intPin;                         //Pin connected to the MCP2515 INT output
+    bool interruptEnabled;                  //True when begin() was given an interrupt pin
+    bool ringPeeked;                        //True while peekReceive() is pointing at the oldest slot of rxRing
+    static volatile uint8_t spiLockDepth;   //Non-zero while any controller is talking on the shared SPI bus so no interrupt collides with it. Counts nested lockSPI() calls.
+    static CAN_Controller *controllers[CAN_MAX_CONTROLLERS];   //Every MCP2515 controller started with begin(), serviced in turn when deferred interrupts are run
+    static uint8_t controllerCount;
+    static uint8_t nextServiced;            //Controller serviced first on the next pass, rotated so no bus always goes first
+    volatile bool interruptPending;         //Set by the interrupt when it had to defer its work because the SPI bus was busy
+    bool txPipelined;                       //True when all three transmit buffers are used
+    LV_CANMessage txInFlight[3];            //Frame loaded into each transmit buffer, used to keep frames with the same ID in order and to stamp completion
+    uint8_t txBufferPriority[3];            //TXP bits last written to each TXBnCTRL, so loadTxBuffer can use LOAD TX BUFFER when they don't change
+    void collectTxCompletions(uint8_t status);
+    void interruptHandler();
+    void serviceInterrupt();
+    void enableInterrupts();
+    void drainReceiveBuffers();
+    bool readFrame(LV_CANMessage &msg);
+    bool serviceTxQueue();
+    void loadTxBuffer(uint8_t bufferIndex, const LV_CANMessage &msg, uint8_t priority);
+    void lockSPI();
+    void unlockSPI();
+    void registerController();
+    void mcpSelect();
+    void mcpDeselect();
+    uint8_t mcpReadStatus();
+    void mcpReadRegisters(uint8_t address, uint8_t *values, uint8_t count);
+    void mcpTransferBytes(const uint8_t *tx, uint8_t *rx, uint8_t count);
+    void mcpWriteRegisters(uint8_t address, const uint8_t *values, uint8_t count);
+    void mcpBitModify(uint8_t address, uint8_t mask, uint8_t value);
+    void mcpRequestToSend(uint8_t bufferMask);
+    #endif
+};
+
+/// @brief Common body of the boards' sendCANData. Packs board with its Layout onto boardAddress, asks board.sendPolicy whether to transmit, and tells
+/// the policy when the controller drops the frame so the next call retries. Lives here rather than beside CAN_SendPolicy because it needs CAN_Controller.
+/// @param board Board object with boardAddress, sendPolicy and a CANLayout named Layout.
+/// @param controller The CAN bus controller attached to this microcontroller.
+template <class Board> void sendBoardFrame(Board &board, CAN_Controller &controller){
+    LV_CANMessage msg;
+    msg.addr = board.boardAddress;
+    msg.extended = board.boardAddress > 0x7FF;
+    Board::Layout::pack(board, msg);
+    if(!board.sendPolicy.shouldSend(msg)) return;
+    if(controller.CANSend(msg) >= CAN_TX_DROPPED) board.sendPolicy.sendFailed();
+}
+
+#define CAN_DISPATCH_MAX_HANDLERS   32     //Number of CAN IDs a CAN_Dispatcher can route
+#define CAN_DISPATCH_TABLE_SIZE     128     //Slots in the dispatch hash table. Must be a power of two, kept at 4x the handlers so a perfect hash is found quickly.
+#define CAN_DISPATCH_POLL_BATCH     8       //Frames pulled from the CAN_Controller per receiveBatch call in CAN_Dispatcher::poll
+
+typedef void (*CAN_Handler)(void *context, const LV_CANMessage &msg);     //Handler called by CAN_Dispatcher. context is the pointer given to addHandler, usually the board object.
+
+/// @brief Routes received frames straight to the one handler registered for their CAN ID. Register handlers in setup(), after which each frame costs
+/// one multiply and one table lookup no matter how many boards are listening. Example: 'dispatcher.addBoard(dc); dispatcher.addBoard(pc);' then 'dispatcher.poll(canController);' in loop().
+class CAN_Dispatcher{
+    public:
+    bool addHandler(uint32_t addr, CAN_Handler handler, void *context);     //Routes frames on addr to handler. Returns false if the table is full or addr already has a handler.
+    template <class Board> bool addBoard(Board &board){ return board.registerReceive(*this); }    //Registers every CAN ID the board object receives on
+    template <class T, void (T::*Method)(const LV_CANMessage &)> static void memberHandler(void *context, const LV_CANMessage &msg){ (static_cast<T*>(context)->*Method)(msg); }  //Adapts a member function into a CAN_Handler
+    bool dispatch(const LV_CANMessage &msg);       //Hands msg to its handler. Returns false if no handler is registered for its ID.
+    size_t poll(CAN_Controller &controller, size_t maxFrames = CAN_RX_RING_SIZE);    //Receives up to maxFrames frames from controller and dispatches them. Returns the number received.
+    uint32_t unhandledCount();              //Number of frames dispatched with no handler registered for their ID.
+
+    private:
+    struct Entry{
+        uint32_t addr;
+        CAN_Handler handler;
+        void *context;
+    };
+    Entry entries[CAN_DISPATCH_MAX_HANDLERS];       //Sorted by addr
+    uint8_t entryCount = 0;
+    uint8_t table[CAN_DISPATCH_TABLE_SIZE];         //Index + 1 into entries for each hash slot, 0 when empty
+    uint32_t hashMultiplier = 0;                    //0 when no perfect hash was found, dispatch falls back to a binary search of entries
+    bool built = false;
+    uint32_t unhandled = 0;
+    void build();
+    uint8_t hashSlot(uint32_t addr);
+};
+
+#define CAN_BUS_MANAGER_MAX_BUSES   4       //Number of buses a CAN_BusManager can service
+#define CAN_BUS_DEFAULT_QUANTUM     4       //Frames dispatched from a bus per CAN_BusManager::poll before moving on to the next bus
+
+/// @brief Services several CAN buses from one loop() in turn, e.g. the HV bus and the LV bus on the HV Controller. Each poll() services every bus's transmit
+/// queue and dispatches at most its quantum of received frames, so a busy bus (cell broadcasts every 4 ms) can't hold up transmitting on a quiet one.
+/// Example: 'buses.addBus(hvCAN, hvDispatcher, 8); buses.addBus(lvCAN, lvDispatcher);' then 'buses.poll();' in loop().
+class CAN_BusManager{
+    public:
+    bool addBus(CAN_Controller &controller, CAN_Dispatcher &dispatcher, uint8_t quantum = CAN_BUS_DEFAULT_QUANTUM);  //Returns false if the manager is full.
+    size_t poll();                          //Services each bus once. Returns the number of frames dispatched.
+    uint8_t busCount();
+
+    private:
+    CAN_Controller *controllers[CAN_BUS_MANAGER_MAX_BUSES];
+    CAN_Dispatcher *dispatchers[CAN_BUS_MANAGER_MAX_BUSES];
+    uint8_t quanta[CAN_BUS_MANAGER_MAX_BUSES];
+    uint8_t count = 0;
+    uint8_t nextBus = 0;                    //Bus serviced first on the next poll, rotated so no bus always goes first
+};
+
+#define CAN_SNIFFER_BUFFER_SIZE     2048    //Bytes of encoded frames CAN_SnifferStream holds while the serial port catches up. Must be a power of two.
+#define CAN_SNIFFER_SYNC            0xA5    //First byte of every CAN_SnifferStream record
+#define CAN_SNIFFER_FLAG_EXTENDED   0x80    //Record flags: frame has a 29-bit ID
+#define CAN_SNIFFER_FLAG_DROPPED    0x40    //Record flags: not a frame, the 4 byte field holds the total number of frames dropped so far
+#define CAN_SNIFFER_RECORD_MAX      19      //Longest record: sync, flags, 4 byte timestamp, 4 byte ID, 8 data bytes, checksum
+
+/// @brief Streams received frames out a USB serial port in a compact binary format, for capturing a bus with a CAN_Controller in sniffer mode. Frames are
+/// encoded into a buffer and written in large blocks only as fast as the port accepts them, so poll() never blocks loop(). Each record is:
+/// sync (0xA5), flags (bits 0-3 length, CAN_SNIFFER_FLAG_EXTENDED, CAN_SNIFFER_FLAG_DROPPED), 4 byte receive timestamp in microseconds, ID (2 bytes, or 4 if
+/// extended), the data bytes, and a checksum (sum of every byte after the sync). Multi-byte fields are little-endian. An 8 byte standard frame is 17 bytes,
+/// about 68 kB/s for a saturated 500 kbps bus.
+/// Example: 'canController.setSnifferMode(true);' in setup() then 'sniffer.poll(canController);' in loop() with 'CAN_SnifferStream sniffer(Serial);'.
+class CAN_SnifferStream{
+    public:
+    CAN_SnifferStream(USBSerial &serialPort);
+    bool add(const LV_CANMessage &msg);     //Encodes msg into the buffer. Returns false and counts a drop if the buffer is full.
+    size_t poll(CAN_Controller &controller, size_t maxFrames = CAN_RX_RING_SIZE);   //Encodes up to maxFrames received frames and writes what the port will take. Returns the number encoded.
+    void flush();                           //Writes as much of the buffer as the port accepts without blocking.
+    uint32_t droppedCount();                //Frames lost because the buffer was full.
+
+    private:
+    USBSerial *port;
+    uint8_t buffer[CAN_SNIFFER_BUFFER_SIZE];
+    uint16_t head = 0;                      //Next byte to write into
+    uint16_t tail = 0;                      //Next byte to send
+    uint32_t dropped = 0;
+    uint32_t reportedDropped = 0;           //Value of dropped in the last CAN_SNIFFER_FLAG_DROPPED record
+    uint16_t freeSpace();
+    void putRecord(uint8_t flags, uint32_t timestamp, uint32_t field, uint8_t fieldBytes, const uint8_t *data, uint8_t len);
+};
+
+/// @brief Fixed-capacity store of N frames kept as separate arrays (IDs, lengths, timestamps, 64-bit payloads) instead of an array of LV_CANMessage.
+/// A loop that only looks at IDs or only at payloads then walks one tightly packed array, which the compiler can vectorize on host tools and which
+/// touches far fewer cache lines on the target. The arrays are public so filtering, decoding and logging code can index them directly; the first
+/// size() entries of each are valid. Example: 'CANFrameBuffer<512> capture;' then 'capture.receiveFrom(canController);' in loop().
+template <size_t N>
+class CANFrameBuffer{
+    public:
+    uint32_t ids[N];                        //CAN ID of each frame
+    uint8_t lengths[N];                     //Number of data bytes in each frame (0-8)
+    bool extended[N];                       //True for 29-bit IDs
+    uint32_t timestamps[N];                 //rxTimestampUs of each frame
+    uint64_t payloads[N];                   //Data bytes of each frame, byte0 in the low 8 bits
+
+    bool push(const LV_CANMessage &msg){    //Appends msg. Returns false if the buffer is full.
+        if(frameCount >= N) return false;
+        ids[frameCount] = msg.addr;
+        lengths[frameCount] = msg.len;
+        extended[frameCount] = msg.extended;
+        timestamps[frameCount] = msg.rxTimestampUs;
+        payloads[frameCount] = msg.payload();
+        frameCount++;
+        return true;
+    }
+    void get(size_t index, LV_CANMessage &msg) const {     //Copies frame index back out as an LV_CANMessage
+        msg.addr = ids[index];
+        msg.len = lengths[index];
+        msg.extended = extended[index];
+        msg.rxTimestampUs = timestamps[index];
+        msg.setPayload(payloads[index]);
+    }
+    size_t receiveFrom(CAN_Controller &controller, size_t maxFrames = N){     //Moves received frames from controller into the buffer until it is full. Returns the number added.
+        size_t added = 0;
+        const LV_CANMessage *msg;
+        while(added < maxFrames && frameCount < N && (msg = controller.peekReceive()) != NULL){
+            push(*msg);
+            controller.releaseReceive();
+            added++;
+        }
+        return added;
+    }
+    size_t findId(uint32_t addr, uint16_t *indices, size_t maxIndices) const {   //Stores the index of every frame on addr in indices. Returns the number found.
+        size_t found = 0;
+        for(size_t i = 0; i < frameCount && found < maxIndices; i++){
+            indices[found] = (uint16_t)i;
+            found += ids[i] == addr;        //Branch-free so the scan stays a straight loop over ids
+        }
+        return found;
+    }
+    size_t retainIds(const uint32_t *keepIds, size_t keepCount){   //Drops every frame whose ID is not in keepIds, keeping the rest in order. Returns the new size.
+        size_t kept = 0;
+        for(size_t i = 0; i < frameCount; i++){
+            bool keep = false;
+            for(size_t k = 0; k < keepCount; k++) keep |= ids[i] == keepIds[k];
+            if(!keep) continue;
+            ids[kept] = ids[i];
+            lengths[kept] = lengths[i];
+            extended[kept] = extended[i];
+            timestamps[kept] = timestamps[i];
+            payloads[kept] = payloads[i];
+            kept++;
+        }
+        frameCount = kept;
+        return kept;
+    }
+    size_t size() const { return frameCount; }
+    size_t capacity() const { return N; }
+    bool full() const { return frameCount >= N; }
+    void clear(){ frameCount = 0; }
+
+    private:
+    size_t frameCount = 0;
+};
+
+#define CAN_LIVENESS_MAX_BOARDS     16      //Number of boards a CAN_LivenessTable can watch
+
+#define CAN_MAX_AGE_MS          4000000UL       //Longest age CAN_ReceiveClock measures in microseconds, kept under micros()'s 71 minute wrap
+#define CAN_AGE_EXPIRED_US      (UINT32_MAX - 1)    //dataAgeUs() of a board not heard from for over CAN_MAX_AGE_MS
+
+/// @brief Remembers when a board's last frame was received and reports how old its data is. Every board class keeps one as receiveClock and
+/// forwards dataAgeUs() and isFresh() to it.
+class CAN_ReceiveClock{
+    public:
+    uint32_t lastUs = 0;                    //rxTimestampUs of the last frame
+    uint32_t lastMs = 0;                    //millis() when the last frame was parsed, used to tell ages past micros()'s wrap
+    void stamp(const LV_CANMessage &msg);   //Records a received frame, called from receiveCANData
+    void reset(){ received = false; }       //Back to nothing received
+    uint32_t ageUs();                       //Microseconds since the last frame, or UINT32_MAX if none has been received
+    bool isFresh(uint32_t timeoutMs);       //True if a frame arrived within the last timeoutMs
+
+    private:
+    bool received = false;
+    bool expired = false;                   //Latched once the age passes CAN_MAX_AGE_MS, cleared by the next frame
+};
+
+typedef uint32_t (*CAN_AgeFunction)(void *board);     //Returns a board's dataAgeUs(), used by CAN_LivenessTable
+
+/// @brief Watches every board this microcontroller listens to and reports which have gone quiet. Each board gets a timeout (normally a few of its
+/// send periods); update() marks a board stale once nothing has arrived from it for that long and counts how many times each board dropped out.
+/// Example: 'int8_t dash = liveness.addBoard(dc, 300, "Dash");' in setup(), then 'liveness.update();' and 'if(!liveness.isFresh(dash)) //Dash is gone' in loop().
+class CAN_LivenessTable{
+    public:
+    template <class Board> int8_t addBoard(Board &board, uint32_t timeoutMs, const char *name = ""){ return addEntry(&boardAge<Board>, &board, timeoutMs, name); }   //Returns the board's index, or -1 if the table is full or timeoutMs is 0
+    void update();                          //Checks every board's age. Call from loop().
+    bool isFresh(int8_t index);             //True if the board was heard from within its timeout at the last update()
+    bool allFresh();                        //True if every board in the table is fresh
+    uint8_t staleCount();                   //Number of boards that are not fresh
+    uint32_t missedHeartbeats(int8_t index);    //Whole timeout periods since the board was last heard from, 0 while it is fresh
+    uint16_t dropoutCount(int8_t index);    //Number of times the board went from fresh to stale
+    const char *name(int8_t index);
+    uint8_t boardCount();
+
+    private:
+    struct Entry{
+        CAN_AgeFunction age;
+        void *board;
+        uint32_t timeoutUs;
+        const char *name;
+        bool fresh;
+        uint32_t missed;
+        uint16_t dropouts;
+    };
+    Entry entries[CAN_LIVENESS_MAX_BOARDS];
+    uint8_t entryCount = 0;
+    int8_t addEntry(CAN_AgeFunction age, void *board, uint32_t timeoutMs, const char *name);
+    template <class Board> static uint32_t boardAge(void *board){ return static_cast<Board*>(board)->dataAgeUs(); }
+};
+
+#define CAN_SCHED_MAX_FRAMES    24      //Number of periodic frames a CAN_PeriodicScheduler can hold
+#define CAN_SCHED_SLOT_MS       5       //Width of the time slots CAN_PeriodicScheduler spreads frames across. Frames less than this apart count as a burst.
+#define CAN_SCHED_AUTO_PHASE    0xFFFF  //addFrame phaseMs value that puts the frame in the least crowded slot of its period
+
+typedef bool (*CAN_FrameBuilder)(void *context, LV_CANMessage &msg);  //Fills in msg's data and len for CAN_PeriodicScheduler. msg.addr is already set. Return false to skip this period.
+
+/// @brief Sends a table of periodic frames, each with its own period, phase offset and builder function. By default each frame is given the phase
+/// that overlaps least with the frames already added, so ten 1000ms frames go out one per slot instead of in one burst.
+/// Example: 'scheduler.addFrame(0x3B7, 250, &CAN_PeriodicScheduler::memberBuilder<MyBoard_CAN, &MyBoard_CAN::buildFrame>, &board);' in setup(),
+/// then 'scheduler.service(canController);' in loop().
+class CAN_PeriodicScheduler{
+    public:
+    int8_t addFrame(uint32_t addr, uint16_t periodMs, CAN_FrameBuilder builder, void *context, uint16_t phaseMs = CAN_SCHED_AUTO_PHASE);  //Returns the frame's index, or -1 if the table is full
+    template <class T, bool (T::*Method)(LV_CANMessage &)> static bool memberBuilder(void *context, LV_CANMessage &msg){ return (static_cast<T*>(context)->*Method)(msg); }  //Adapts a member function into a CAN_FrameBuilder
+    uint8_t service(CAN_Controller &controller);    //Builds and sends every frame that is due. Returns the number the controller sent or queued.
+    void restart();                         //Starts the schedule over from the next service(), e.g. after the bus comes back
+    void clear();                           //Removes every frame
+    uint16_t phaseOf(int8_t index);         //Phase offset the frame was given, in ms
+    uint8_t frameCount();
+
+    private:
+    struct Entry{
+        uint32_t addr;
+        CAN_FrameBuilder builder;
+        void *context;
+        uint16_t periodMs;
+        uint16_t phaseMs;
+        uint32_t nextDue;                   //millis() value the frame is next sent at
+        uint32_t retryAt;                   //millis() value a dropped frame is tried again at, while retrying is set
+        bool retrying;
+    };
+    Entry entries[CAN_SCHED_MAX_FRAMES];
+    uint8_t entryCount = 0;
+    bool started = false;                   //False until the first service() anchors every frame's nextDue
+    uint32_t epoch = 0;                     //millis() at the first service(), every phase is counted from here
+    uint16_t pickPhase(uint16_t periodMs);
 };
 
 /// @brief Class to send data from Dash Controller OR to receive CAN data from the Dash Controller on other boards.
@@ -309,11 +853,27 @@ class DashController_CAN{
     bool bmsFaultDetected;      //Flag that is set true if a Battery Management System fault has been detected.
     bool rmsFaultDetected;      //Flag that is set true if a Motor Controller fault has been detected.
     bool boardDetected;         //Flag set true in receiveCANData when a message from the Dash Controller has been received. Use this on other boards to check if you're hearing from the Dash Controller.
+    CAN_ReceiveClock receiveClock;  //When the last frame from this board was received. Use dataAgeUs() to check how stale the fields are.
+    CAN_SendPolicy sendPolicy;  //When sendCANData transmits. Sends on every call unless sendPolicy.heartbeatMs is set.
+
+    typedef CANLayout<8,                                        //Wire format, see DASH_CONTROL_ADDR
+        CAN_SIGNAL(DashController_CAN, rightTurnPWM, 0, 8),
+        CAN_SIGNAL(DashController_CAN, leftTurnPWM, 8, 8),
+        CAN_SIGNAL(DashController_CAN, batteryFanPWM, 24, 8),
+        CAN_SIGNAL(DashController_CAN, headlight, 32, 1),
+        CAN_SIGNAL(DashController_CAN, highbeam, 33, 1),
+        CAN_SIGNAL(DashController_CAN, reversePress, 37, 1),
+        CAN_SIGNAL(DashController_CAN, driveMode, 48, 8),
+        CAN_SIGNAL(DashController_CAN, radiatorFan, 56, 1),
+        CAN_SIGNAL(DashController_CAN, radiatorPump, 57, 1)> Layout;
 
     DashController_CAN(uint32_t boardAddr);
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    void receiveCANData(LV_CANMessage msg);
+    void receiveCANData(const LV_CANMessage &msg);
+    bool registerReceive(CAN_Dispatcher &dispatcher);       //Registers receiveCANData with a CAN_Dispatcher for this board's address
+    uint32_t dataAgeUs(){ return receiveClock.ageUs(); }                        //See CAN_ReceiveClock::ageUs
+    bool isFresh(uint32_t timeoutMs){ return receiveClock.isFresh(timeoutMs); }  //See CAN_ReceiveClock::isFresh. Unlike boardDetected, goes false when the board drops off the bus.
     
 };
 
@@ -334,11 +894,31 @@ class PowerController_CAN{
     bool LowPowerMode;          //Flag indicating to the rest of the system that we are operating in Low Power Mode. Use this to update controls of other boards!
     bool LowACCBattery;         //Flag indicating that the 12V accessory is low (true) or normal (false).
     bool boardDetected;         //Flag set true in receiveCANData when a message from the Power Controller has been received. Use this on other boards to check if you're hearing from the Power Controller.
+    CAN_ReceiveClock receiveClock;  //When the last frame from this board was received. Use dataAgeUs() to check how stale the fields are.
+    CAN_SendPolicy sendPolicy;  //When sendCANData transmits. Sends on every call unless sendPolicy.heartbeatMs is set.
+
+    typedef CANLayout<8,                                        //Wire format, see POWER_CONTROL_ADDR
+        CAN_SIGNAL(PowerController_CAN, BrakeSense, 0, 1),
+        CAN_SIGNAL(PowerController_CAN, PushToStart, 1, 1),
+        CAN_SIGNAL(PowerController_CAN, ACCharge, 2, 1),
+        CAN_SIGNAL(PowerController_CAN, SolarCharge, 3, 1),
+        CAN_SIGNAL(PowerController_CAN, Horn, 4, 1),
+        CAN_SIGNAL(PowerController_CAN, Acc, 8, 1),
+        CAN_SIGNAL(PowerController_CAN, Ign, 9, 1),
+        CAN_SIGNAL(PowerController_CAN, FullStart, 10, 1),
+        CAN_SIGNAL(PowerController_CAN, CarOn, 11, 1),
+        CAN_SIGNAL(PowerController_CAN, StartUp, 12, 1),
+        CAN_SIGNAL(PowerController_CAN, LowPowerMode, 16, 1),
+        CAN_SIGNAL(PowerController_CAN, LowACCBattery, 17, 1),
+        CAN_SIGNAL(PowerController_CAN, boardDetected, 18, 1)> Layout;
 
     PowerController_CAN(uint32_t boardAddr);
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    void receiveCANData(LV_CANMessage msg);
+    void receiveCANData(const LV_CANMessage &msg);
+    bool registerReceive(CAN_Dispatcher &dispatcher);       //Registers receiveCANData with a CAN_Dispatcher for this board's address
+    uint32_t dataAgeUs(){ return receiveClock.ageUs(); }                        //See CAN_ReceiveClock::ageUs
+    bool isFresh(uint32_t timeoutMs){ return receiveClock.isFresh(timeoutMs); }  //See CAN_ReceiveClock::isFresh. Unlike boardDetected, goes false when the board drops off the bus.
 
 };
 
@@ -348,23 +928,64 @@ class LPDRV_RearLeft_CAN{
     bool bmsFaultInput;         //This board reads in the Battery Management System fault line and tells the rest of the system if we have a fault.
     bool switchFaultInput;      //This board reads in the manual kill switch fault line and tells the rest of the system if we have a fault.
     bool boardDetected;         //Flag set true in receiveCANData when a message from the Power Controller has been received. Use this on other boards to check if you're hearing from the Power Controller.
+    CAN_ReceiveClock receiveClock;  //When the last frame from this board was received. Use dataAgeUs() to check how stale the fields are.
+    CAN_SendPolicy sendPolicy;  //When sendCANData transmits. Sends on every call unless sendPolicy.heartbeatMs is set.
+
+    typedef CANLayout<2,                                        //Wire format, see REAR_LEFT_DRIVER. Only two bytes are sent.
+        CAN_SIGNAL(LPDRV_RearLeft_CAN, bmsFaultInput, 0, 1),
+        CAN_SIGNAL(LPDRV_RearLeft_CAN, switchFaultInput, 8, 1)> Layout;
+
     LPDRV_RearLeft_CAN(uint32_t boardAddr);
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    void receiveCANData(LV_CANMessage msg);
+    void receiveCANData(const LV_CANMessage &msg);
+    bool registerReceive(CAN_Dispatcher &dispatcher);       //Registers receiveCANData with a CAN_Dispatcher for this board's address
+    uint32_t dataAgeUs(){ return receiveClock.ageUs(); }                        //See CAN_ReceiveClock::ageUs
+    bool isFresh(uint32_t timeoutMs){ return receiveClock.isFresh(timeoutMs); }  //See CAN_ReceiveClock::isFresh. Unlike boardDetected, goes false when the board drops off the bus.
 };
 
+//Bits of CamryCluster_CAN's packed indicator state that each instantly-sent frame depends on. A frame is re-sent as soon as any of its bits change.
+#define CLUSTER_STATE_ABS               0x0000000000000001ULL   //brakeIcon
+#define CLUSTER_STATE_LIGHTING          0x0000000000000006ULL   //headlight, highbeam
+#define CLUSTER_STATE_AIRBAG            0x0000000000000008ULL   //seatBeltIcon
+#define CLUSTER_STATE_ENGINE_CONTROL    0x00000000FFFF0F00ULL   //checkEngineOn, clusterBacklight, chargingSystemMalfunction, oilPressureLow, motorTempDegC
+#define CLUSTER_STATE_ENGINE_PROMPTS    0x0000FFFF00000000ULL   //LCD_EngineStoppedCode, LCD_CheckEnginePrompt
+
+//Index of each periodic frame in CamryCluster_CAN's cached frame images
+#define CLUSTER_FRAME_PARKING_BRAKE     0
+#define CLUSTER_FRAME_SPEED             1
+#define CLUSTER_FRAME_FUEL_ECONOMY      2
+#define CLUSTER_FRAME_ABS               3
+#define CLUSTER_FRAME_POWER_STEER       4
+#define CLUSTER_FRAME_PARK_ASSIST       5
+#define CLUSTER_FRAME_MOTOR_SPOOF       6
+#define CLUSTER_FRAME_TRANSMISSION      7
+#define CLUSTER_FRAME_AIRBAG            8
+#define CLUSTER_FRAME_LANE_DEPART       9
+#define CLUSTER_FRAME_PRECOLLISION      10
+#define CLUSTER_FRAME_PARKING           11
+#define CLUSTER_FRAME_LIGHTING          12
+#define CLUSTER_FRAME_ENGINE_CONTROL    13
+#define CLUSTER_FRAME_SMART_KEY         14
+#define CLUSTER_FRAME_ANIMATIONS        15
+#define CLUSTER_FRAME_ENGINE_PROMPTS    16
+#define CLUSTER_FRAME_OUTDOOR_TEMP      17
+#define CLUSTER_FRAME_COUNT             18
+
 /// @brief Class to send data from Dash Controller to Camry Instrument Cluster.
 class CamryCluster_CAN{
     private:
-    bool last_headlight;                //Internal flag to check last state of headlight before sending again to cluster
-    bool last_highbeam;                 //Internal flag to check last state of highbeam before sending again to cluster
-    uint32_t timer25ms;                 //Internal timer to keep track of 25ms packets
-    uint32_t timer250ms;                //Internal timer to keep track of 250ms packets
-    uint32_t timer1000ms;               //Internal timer to keep track of 1000ms packets
-    void send25msPackets(CAN_Controller &controller);       //Send all the packets needed every 25ms to the instrument cluster
-    void send250msPackets(CAN_Controller &controller);      //Send all the packets needed every 250ms to the instrument cluster
-    void send1000msPackets(CAN_Controller &controller);     //Send all the packets needed every 1000ms to the instrument cluster
+    uint64_t frameImage[CLUSTER_FRAME_COUNT];   //Cached data bytes of each periodic frame (byte0 in the low 8 bits), indexed by CLUSTER_FRAME_*
+    uint32_t frameSource[CLUSTER_FRAME_COUNT];  //The fields each image was last patched from, packed into one word
+    uint32_t staleImages;               //Bit per CLUSTER_FRAME_* index, set for images that must be patched on their next send
+    bool imageSourceChanged(uint8_t frame, uint32_t source);    //True if the image's fields changed since it was last patched
+    uint64_t indicatorState;            //Packed copy of the fields behind the instantly-sent frames as of the last sendCANData, see the CLUSTER_STATE macros
+    uint16_t speedFakeTimer;            //Odometer tick counter sent in the speedometer frame
+    bool speedHalfPeriod;               //Toggles every speedometer frame, speedFakeTimer advances on every other one
+    uint64_t packIndicatorState();      //Packs the fields behind the instantly-sent frames into one word
+    CAN_PeriodicScheduler scheduler;    //Sends the 25ms, 250ms and 1000ms spoof frames, spread out so the 1000ms frames don't go out in one burst
+    bool buildFrame(LV_CANMessage &msg);                    //Fills in the spoof frame for msg.addr, called by the scheduler
+    void sendChangedPackets(CAN_Controller &controller);    //Sends the frames whose fields changed right away instead of waiting for their period
 
     public:
     bool brakeIcon;                     //Set true to turn on red BRAKE text on instrument cluster, false to turn off. See spreadsheet linked in CamryCluster_CAN::sendCANData for details.
@@ -412,7 +1033,7 @@ class CamryCluster_CAN{
 
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    //void receiveCANData(LV_CANMessage msg);
+    //void receiveCANData(const LV_CANMessage &msg);
 };
 
 /// @brief Class to send data from HV Controller OR to receive CAN data from the HV Controller on other boards.
@@ -422,12 +1043,20 @@ class HVController_CAN{
     bool Killswitch;                  //Killswitch on the outside of the car
     bool BMSFault;                    //Indicator for a fault in the BMS
     bool boardDetected;                    //Flag to ensure we have heard from the board
+    CAN_ReceiveClock receiveClock;  //When the last frame from this board was received. Use dataAgeUs() to check how stale the fields are.
+    CAN_SendPolicy sendPolicy;  //When sendCANData transmits. Sends on every call unless sendPolicy.heartbeatMs is set.
 
+    typedef CANLayout<1,                                        //Wire format, see HV_CONTROL_ADDR. Only one byte is sent.
+        CAN_SIGNAL(HVController_CAN, Killswitch, 0, 1),
+        CAN_SIGNAL(HVController_CAN, BMSFault, 1, 1)> Layout;
 
     HVController_CAN(uint32_t boardAddr);
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    void receiveCANData(LV_CANMessage msg);
+    void receiveCANData(const LV_CANMessage &msg);
+    bool registerReceive(CAN_Dispatcher &dispatcher);       //Registers receiveCANData with a CAN_Dispatcher for this board's address
+    uint32_t dataAgeUs(){ return receiveClock.ageUs(); }                        //See CAN_ReceiveClock::ageUs
+    bool isFresh(uint32_t timeoutMs){ return receiveClock.isFresh(timeoutMs); }  //See CAN_ReceiveClock::isFresh. Unlike boardDetected, goes false when the board drops off the bus.
 
 };
 
@@ -1,30 +1,47 @@
 #include "DecentralizedLV-HVBoards.h"
 #include "vector"
-#include "map"
+#include "math.h"
 
 
 std::vector<float> cell_telemetry(105);
 unsigned int cell_telemetry_counter = 0;
 
+/// @brief Stores value in field and sets bit in changed if that changed the field.
+template <class T, class V> static inline void updateField(T &field, V value, uint32_t bit, uint32_t &changed){
+  if(field == (T)value) return;
+  field = (T)value;
+  changed |= bit;
+}
+
+/// @brief Float mode: sets field to value * scale, rounded, unless value is still the float updateFloatFields derived from field. Decoded
+/// integers then pass through untouched instead of losing an LSB on the way through float.
+template <class T> static inline void scaleField(T &field, float value, float scale){
+  if(value == field / scale) return;    //Same expression as updateFloatFields, so an untouched float always compares equal
+  field = (T)lroundf(value * scale);
+}
+
 OrionBMS::OrionBMS(uint32_t packStatsAddress, uint32_t cellStatsDTCAddress, uint32_t currentLimitTempAddress, uint32_t j1772Address)
 {
   packStatsAddr = packStatsAddress;
   cellStatsDTCAddr = cellStatsDTCAddress;
   currentLimitTempAddr = currentLimitTempAddress;
   j1772Addr = j1772Address;
+  lastHVReceiveUs = 0;
+  forwardLatencyUs = 0;
 }
 
 void OrionBMS::initialize()
 {
-  packCurrentAmps = 0.0;                     //Current number of amps being charged/discharged from the pack
-  packInstantaneousVoltage = 0.0;            //Raw voltage reading of the full pack
-  inputSupplyVoltage = 0.0;                  //12V voltage the BMS is getting
-  avgCellVoltage = 0.0;                      //Average voltage of all the cells in the pack (calculated by the BMS)
-  highestCellVoltage = 0.0;                  //Highest voltage of any cell in the pack (calculated by the BMS)
-  lowestCellVoltage = 0.0;                   //Lowest voltage of any cell in the pack (calculated by the BMS)
-  packAmpHours = 0.0;                        //Amp hours of the pack (estimated by the BMS)
-  packResistanceOhms = 0.0;                  //Resistance estimated by the BMS for the pack (estimated by the BMS)
-  lowestCellResistanceOhms = 0.0;            //Resistance of the lowest cell in the pack (calculated by the BMS)
+  packCurrentDeciAmps = 0;                   //Current number of amps being charged/discharged from the pack
+  packDeciVolts = 0;                         //Raw voltage reading of the full pack
+  inputSupplyDeciVolts = 0;                  //12V voltage the BMS is getting
+  avgCellDeciVolts = 0;                      //Average voltage of all the cells in the pack (calculated by the BMS)
+  highestCellDeciVolts = 0;                  //Highest voltage of any cell in the pack (calculated by the BMS)
+  lowestCellDeciVolts = 0;                   //Lowest voltage of any cell in the pack (calculated by the BMS)
+  packDeciAmpHours = 0;                      //Amp hours of the pack (estimated by the BMS)
+  packResistanceMilliOhms = 0;               //Resistance estimated by the BMS for the pack (estimated by the BMS)
+  lowestCellResistanceDeci = 0;              //Resistance of the lowest cell in the pack (calculated by the BMS)
+  updateFloatFields(BMS_FIELD_ALL);          //Zero the float fields too
   dtcFlags1 = 0;                             //Bit masks for error code type 1. See the Orion BMS manual for which bits represent which errors.
   dtcFlags2 = 0;                             //Bit masks for error code type 2. See the Orion BMS manual for which bits represent which errors.
   dischargeCurrentLimit = 0;                 //Discharge current limit in amps, set by the Orion BMS. This is the maximum discharge current that can be sent from the pack.
@@ -40,30 +57,54 @@ void OrionBMS::initialize()
   cellStatsDTCReceived = false;    
   currentLimitTempReceived = false;
   j1772Received = false;           
+  changedFields = 0;
 }
 
-void OrionBMS::sendPackStats(CAN_Controller &controller){
-  uint16_t packCurrentTemp = (uint16_t)(packCurrentAmps * 10);                  //Convert to 0.1A increments
-  uint16_t packVoltageTemp = (uint16_t)(packInstantaneousVoltage * 10);         //Convert to 0.1V increments
-  uint8_t packAmpHoursTemp = (uint8_t)(packAmpHours * 10);                      //Convert to 0.1Ah increments
-  uint8_t packResistanceTemp = (uint8_t)(packResistanceOhms * 1000);            //Convert to 1mOhm increments
-  uint8_t inputSupplyVoltageTemp = (uint8_t)(inputSupplyVoltage * 10);          //Convert to 0.1V increments
-  uint8_t packSOCTemp = (uint8_t)packSOC;                                       //State of charge is already in 0-100% increments
+/// @brief [Internal Function] In float mode, converts the float fields the application changed into the fixed-point fields that are encoded onto
+/// the LV CAN Bus, so code that sets the floats still sends what it set. Does nothing when HV_FIXED_POINT is set.
+void OrionBMS::scaleFloatFields(){
+#if !HV_FIXED_POINT
+  scaleField(packCurrentDeciAmps, packCurrentAmps, 10.0f);                      //Convert to 0.1A increments
+  scaleField(packDeciVolts, packInstantaneousVoltage, 10.0f);                   //Convert to 0.1V increments
+  scaleField(packDeciAmpHours, packAmpHours, 10.0f);                            //Convert to 0.1Ah increments
+  scaleField(packResistanceMilliOhms, packResistanceOhms, 1000.0f);             //Convert to 1mOhm increments
+  scaleField(inputSupplyDeciVolts, inputSupplyVoltage, 10.0f);                  //Convert to 0.1V increments
+  scaleField(avgCellDeciVolts, avgCellVoltage, 10.0f);                          //Convert to 0.1V increments
+  scaleField(highestCellDeciVolts, highestCellVoltage, 10.0f);                  //Convert to 0.1V increments
+  scaleField(lowestCellDeciVolts, lowestCellVoltage, 10.0f);                    //Convert to 0.1V increments
+  scaleField(lowestCellResistanceDeci, lowestCellResistanceOhms, 10000.0f);     //Convert to 0.1mOhm increments
+#endif
+}
+
+/// @brief [Internal Function] In float mode, recalculates the float fields from the fixed-point fields after they were decoded. Does nothing
+/// when HV_FIXED_POINT is set, where the float accessors calculate on demand instead.
+/// @param fields BMS_FIELD_* bits of the fields that changed. Only their floats are recalculated.
+void OrionBMS::updateFloatFields(uint32_t fields){
+#if !HV_FIXED_POINT
+  if(fields & BMS_FIELD_PACK_CURRENT) packCurrentAmps = packCurrentDeciAmps / 10.0f;                          //Convert to amps
+  if(fields & BMS_FIELD_PACK_VOLTAGE) packInstantaneousVoltage = packDeciVolts / 10.0f;                       //Convert to volts
+  if(fields & BMS_FIELD_PACK_AMP_HOURS) packAmpHours = packDeciAmpHours / 10.0f;                              //Convert to amp hours
+  if(fields & BMS_FIELD_PACK_RESISTANCE) packResistanceOhms = packResistanceMilliOhms / 1000.0f;              //Convert to ohms
+  if(fields & BMS_FIELD_INPUT_SUPPLY_VOLTAGE) inputSupplyVoltage = inputSupplyDeciVolts / 10.0f;              //Convert to volts
+  if(fields & BMS_FIELD_AVG_CELL_VOLTAGE) avgCellVoltage = avgCellDeciVolts / 10.0f;                          //Convert to volts
+  if(fields & BMS_FIELD_HIGH_CELL_VOLTAGE) highestCellVoltage = highestCellDeciVolts / 10.0f;                 //Convert to volts
+  if(fields & BMS_FIELD_LOW_CELL_VOLTAGE) lowestCellVoltage = lowestCellDeciVolts / 10.0f;                    //Convert to volts
+  if(fields & BMS_FIELD_LOW_CELL_RESISTANCE) lowestCellResistanceOhms = lowestCellResistanceDeci / 10000.0f;   //Convert to ohms
+#else
+  (void)fields;                             //Unused, the accessors convert on demand
+#endif
+}
 
+void OrionBMS::sendPackStats(CAN_Controller &controller){
   controller.CANSend(packStatsAddr, 
-    (uint8_t)(packCurrentTemp >> 8), (uint8_t)(packCurrentTemp & 0xFF),
-    (uint8_t)(packVoltageTemp >> 8), (uint8_t)(packVoltageTemp & 0xFF),
-    packAmpHoursTemp, packResistanceTemp, packSOCTemp, inputSupplyVoltageTemp);
+    (uint8_t)(packCurrentDeciAmps >> 8), (uint8_t)(packCurrentDeciAmps & 0xFF),
+    (uint8_t)(packDeciVolts >> 8), (uint8_t)(packDeciVolts & 0xFF),
+    packDeciAmpHours, packResistanceMilliOhms, packSOC, inputSupplyDeciVolts);
 }
 
 void OrionBMS::sendCellStatsDTC(CAN_Controller &controller){
-  uint8_t avgCellVoltageTemp = (uint8_t)(avgCellVoltage * 10);                  //Convert to 0.1V increments
-  uint8_t highestCellVoltageTemp = (uint8_t)(highestCellVoltage * 10);          //Convert to 0.1V increments
-  uint8_t lowestCellVoltageTemp = (uint8_t)(lowestCellVoltage * 10);            //Convert to 0.1V increments
-  uint8_t lowestCellResistanceTemp = (uint8_t)(lowestCellResistanceOhms * 10);  //Convert to 0.1mOhm increments
-
   controller.CANSend(cellStatsDTCAddr, 
-    avgCellVoltageTemp, highestCellVoltageTemp, lowestCellVoltageTemp, lowestCellResistanceTemp,
+    avgCellDeciVolts, highestCellDeciVolts, lowestCellDeciVolts, lowestCellResistanceDeci,
     (uint8_t)(dtcFlags1 >> 8), (uint8_t)(dtcFlags1 & 0xFF),
     (uint8_t)(dtcFlags2 >> 8), (uint8_t)(dtcFlags2 & 0xFF));
 }
@@ -85,69 +126,84 @@ void OrionBMS::sendJ1772Stats(CAN_Controller &controller){
 
 void OrionBMS::sendCANData(CAN_Controller &controller)
 {
+  scaleFloatFields();                   //Pick up any float fields set by the application
+  controller.beginTxBurst();            //Load all four frames into the CAN controller together
   sendPackStats(controller);            //Sends the pack statistics to the LV CAN Bus
   sendCellStatsDTC(controller);         //Sends the cell statistics and DTC error codes to the LV CAN Bus
   sendCurrentLimitAndTemp(controller);  //Sends the current limits and temperatures to the LV CAN Bus
   sendJ1772Stats(controller);           //Sends the J1772 charger status to the LV CAN Bus
+  controller.endTxBurst();
+  if(lastHVReceiveUs) forwardLatencyUs = micros() - lastHVReceiveUs;   //How long the newest HV data waited before going out on the LV bus
 }
 
-void OrionBMS::receivePackStats(LV_CANMessage msg)
+void OrionBMS::receivePackStats(const LV_CANMessage &msg)
 {
   if(msg.addr != packStatsAddr) return; //Ignore messages not meant for this address
 
-  uint16_t packCurrentTemp = (uint16_t)(msg.byte0 << 8 | msg.byte1);                  //Convert to 0.1A increments 
-  uint16_t packVoltageTemp = (uint16_t)(msg.byte2 << 8 | msg.byte3);                 //Convert to 0.1V increments
-
-  packCurrentAmps = (float)(packCurrentTemp / 10.0);                                     //Convert to amps
-  packInstantaneousVoltage = (float)(packVoltageTemp / 10.0);                            //Convert to volts
-  packAmpHours = (float)(msg.byte4 / 10.0);                                              //Convert to amp hours
-  packResistanceOhms = (float)(msg.byte5 / 1000.0);                                      //Convert to ohms
-  packSOC = (uint8_t)msg.byte6;                                                          //State of charge is already in 0-100%
-  inputSupplyVoltage = (float)(msg.byte7 / 10.0);                                        //Convert to volts
+  uint32_t changed = 0;
+  updateField(packCurrentDeciAmps, msg.getBits<48, 16, CAN_BIG_ENDIAN>(), BMS_FIELD_PACK_CURRENT, changed);   //0.1A increments
+  updateField(packDeciVolts, msg.getBits<32, 16, CAN_BIG_ENDIAN>(), BMS_FIELD_PACK_VOLTAGE, changed);         //0.1V increments
+  updateField(packDeciAmpHours, msg.byte4, BMS_FIELD_PACK_AMP_HOURS, changed);                                //0.1Ah increments
+  updateField(packResistanceMilliOhms, msg.byte5, BMS_FIELD_PACK_RESISTANCE, changed);                        //1mOhm increments
+  updateField(packSOC, msg.byte6, BMS_FIELD_PACK_SOC, changed);                                               //State of charge is already in 0-100%
+  updateField(inputSupplyDeciVolts, msg.byte7, BMS_FIELD_INPUT_SUPPLY_VOLTAGE, changed);                      //0.1V increments
+  updateFloatFields(changed);
+  changedFields |= changed;
 
   packStatsReceived = true;                                                              //Set the flag to true to indicate that pack stats have been received
+  receiveClock.stamp(msg);
 }
 
-void OrionBMS::receiveCellStatsDTC(LV_CANMessage msg)
+void OrionBMS::receiveCellStatsDTC(const LV_CANMessage &msg)
 {
   if(msg.addr != cellStatsDTCAddr) return; //Ignore messages not meant for this address
 
-  avgCellVoltage = (float)(msg.byte0 / 10.0);                                            //Convert to volts
-  highestCellVoltage = (float)(msg.byte1 / 10.0);                                        //Convert to volts
-  lowestCellVoltage = (float)(msg.byte2 / 10.0);                                         //Convert to volts
-  lowestCellResistanceOhms = (float)(msg.byte3 / 10.0);                                  //Convert to ohms
-  dtcFlags1 = (uint16_t)(msg.byte4 << 8 | msg.byte5);                                   //Bit masks for error code type 1
-  dtcFlags2 = (uint16_t)(msg.byte6 << 8 | msg.byte7);                                   //Bit masks for error code type 2
+  uint32_t changed = 0;
+  updateField(avgCellDeciVolts, msg.byte0, BMS_FIELD_AVG_CELL_VOLTAGE, changed);                              //0.1V increments
+  updateField(highestCellDeciVolts, msg.byte1, BMS_FIELD_HIGH_CELL_VOLTAGE, changed);                         //0.1V increments
+  updateField(lowestCellDeciVolts, msg.byte2, BMS_FIELD_LOW_CELL_VOLTAGE, changed);                           //0.1V increments
+  updateField(lowestCellResistanceDeci, msg.byte3, BMS_FIELD_LOW_CELL_RESISTANCE, changed);                   //0.1mOhm increments
+  updateField(dtcFlags1, msg.getBits<16, 16, CAN_BIG_ENDIAN>(), BMS_FIELD_DTC_FLAGS_1, changed);              //Bit masks for error code type 1
+  updateField(dtcFlags2, msg.getBits<0, 16, CAN_BIG_ENDIAN>(), BMS_FIELD_DTC_FLAGS_2, changed);               //Bit masks for error code type 2
+  updateFloatFields(changed);
+  changedFields |= changed;
 
   cellStatsDTCReceived = true;                                                           //Set the flag to true to indicate that cell stats and DTC have been received
+  receiveClock.stamp(msg);
 }
 
-void OrionBMS::receiveCurrentLimitAndTemp(LV_CANMessage msg)
+void OrionBMS::receiveCurrentLimitAndTemp(const LV_CANMessage &msg)
 {
   if(msg.addr != currentLimitTempAddr) return; //Ignore messages not meant for this address
 
-  dischargeCurrentLimit = (uint16_t)(msg.byte0 << 8 | msg.byte1);                       //Convert to amps
-  chargeCurrentLimit = (uint16_t)(msg.byte2 << 8 | msg.byte3);                          //Convert to amps
-  bmsAverageTempC = (uint8_t)msg.byte4;                                                 //Average temperature of the BMS
-  bmsInternalTempC = (uint8_t)msg.byte5;                                                //Internal temperature of the BMS
-  thermistorHighTempC = (uint8_t)msg.byte6;                                             //Highest temperature of the thermistor expansion module
-  thermistorLowTempC = (uint8_t)msg.byte7;                                              //Lowest temperature of the thermistor expansion module
+  uint32_t changed = 0;
+  updateField(dischargeCurrentLimit, msg.getBits<48, 16, CAN_BIG_ENDIAN>(), BMS_FIELD_DISCHARGE_LIMIT, changed);    //Amps
+  updateField(chargeCurrentLimit, msg.getBits<32, 16, CAN_BIG_ENDIAN>(), BMS_FIELD_CHARGE_LIMIT, changed);          //Amps
+  updateField(bmsAverageTempC, msg.byte4, BMS_FIELD_AVERAGE_TEMP, changed);                                         //Average temperature of the BMS
+  updateField(bmsInternalTempC, msg.byte5, BMS_FIELD_INTERNAL_TEMP, changed);                                       //Internal temperature of the BMS
+  updateField(thermistorHighTempC, msg.byte6, BMS_FIELD_THERMISTOR_HIGH, changed);                                  //Highest temperature of the thermistor expansion module
+  updateField(thermistorLowTempC, msg.byte7, BMS_FIELD_THERMISTOR_LOW, changed);                                    //Lowest temperature of the thermistor expansion module
+  changedFields |= changed;
 
   currentLimitTempReceived = true;                                                       //Set the flag to true to indicate that current limits and temperatures have been received
+  receiveClock.stamp(msg);
 }
 
-void OrionBMS::receiveJ1772Stats(LV_CANMessage msg)
+void OrionBMS::receiveJ1772Stats(const LV_CANMessage &msg)
 {
   if(msg.addr != j1772Addr) return; //Ignore messages not meant for this address
 
-  j1772PlugState = (bool)msg.byte0;                                                    //True if the J1772 plug is connected to the BMS
-  j1772ACCurrentLimit = (uint8_t)msg.byte1;                                            //AC current limit set by the J1772 plug, in amps
-  j1772ACVoltage = (uint8_t)msg.byte2;                                                 //AC voltage from the J1772 plug, in volts
+  uint32_t changed = 0;
+  updateField(j1772PlugState, msg.byte0 != 0, BMS_FIELD_J1772_PLUG, changed);                                 //True if the J1772 plug is connected to the BMS
+  updateField(j1772ACCurrentLimit, msg.byte1, BMS_FIELD_J1772_CURRENT_LIMIT, changed);                        //AC current limit set by the J1772 plug, in amps
+  updateField(j1772ACVoltage, msg.byte2, BMS_FIELD_J1772_VOLTAGE, changed);                                   //AC voltage from the J1772 plug, in volts
+  changedFields |= changed;
 
   j1772Received = true;                                                                //Set the flag to true to indicate that J1772 stats have been received
+  receiveClock.stamp(msg);
 }
 
-void OrionBMS::receiveCANData(LV_CANMessage msg)
+void OrionBMS::receiveCANData(const LV_CANMessage &msg)
 {
   receivePackStats(msg);            //Receives the pack statistics from the board translating from the HV Bus and parses it into this object
   receiveCellStatsDTC(msg);         //Receives the cell statistics and DTC error codes from the board translating from the HV Bus and parses it into this object
@@ -155,53 +211,70 @@ void OrionBMS::receiveCANData(LV_CANMessage msg)
   receiveJ1772Stats(msg);           //Receives the J1772 charger status from the board translating from the HV Bus and parses it into this object
 }
 
-void OrionBMS::receiveHVCANData(LV_CANMessage msg)
+bool OrionBMS::registerReceive(CAN_Dispatcher &dispatcher)
 {
-  auto bms = bmscanmap.find(msg.addr);
-
-  if (bms != bmscanmap.end()) {
-    // Found the ID in the BMS CAN Map
-    // The unpack will automatically feed the message into the appropriate struct for parsing the data
-    // Conversion from LV_CANMessage to uint8_t array for unpacking
-    //Serial.printlnf("Found BMS ID: %X", msg.addr);
-    uint8_t data[8] = {msg.byte0, msg.byte1, msg.byte2, msg.byte3, msg.byte4, msg.byte5, msg.byte6, msg.byte7};
-    bms->second->unpack(data, msg.addr);
-    return;
-  }
-
-  // BMS pack statistics
-  packCurrentAmps = (float)dbc_bms_msgid_0_x6_b0.pack_current_decode();                 //2 bytes
-  packInstantaneousVoltage = (float)dbc_bms_msgid_0_x6_b0.pack_inst_voltage_decode();   //2 bytes
-  packAmpHours = (float)dbc_bms_msgid_0_x6_b2.pack_amphours_decode();                   //1 byte
-  packResistanceOhms = (float)dbc_bms_msgid_0_x6_b2.pack_resistance_decode();           //1 byte
-  packSOC = (uint8_t)dbc_bms_msgid_0_x6_b0.pack_soc_decode();                           //1 byte          
-  //teleP->bms_pack_soc = float_map(teleP->bms_pack_inst_voltage / 104, 2.55, 4, 0, 100);
-  inputSupplyVoltage = (float)dbc_bms_msgid_0_x6_b5.input_supply_voltage_decode();      //1 byte
-
-  //Cell voltages and resistance
-  avgCellVoltage = (float)dbc_bms_msgid_0_x6_b6.avg_cell_voltage_decode();              //1 byte
-  highestCellVoltage = (float)dbc_bms_msgid_0_x6_b6.high_cell_voltage_decode();         //1 byte
-  lowestCellVoltage = (float)dbc_bms_msgid_0_x6_b3.low_cell_voltage_decode();           //1 byte
-  lowestCellResistanceOhms = (float)dbc_bms_msgid_0_x6_b4.low_cell_resistance_decode(); //1 byte
-
-  //DTC (Error) Codes
-  dtcFlags1 = (uint16_t)dbc_bms_msgid_0_x6_b6.dtc_flags_1_decode();                     //2 bytes
-  dtcFlags2 = (uint16_t)dbc_bms_msgid_0_x6_b6.dtc_flags_2_decode();                     //2 bytes
-
-  //Charge current limits
-  dischargeCurrentLimit = (uint16_t)dbc_bms_msgid_0_x6_b1.pack_dcl_decode();            //2 bytes
-  chargeCurrentLimit = (uint16_t)dbc_bms_msgid_0_x6_b1.pack_ccl_decode();               //2 bytes
-
-  //BMS Temperatures
-  bmsAverageTempC = (uint8_t)dbc_bms_msgid_0_x6_b3.average_temperature_decode();        //1 byte
-  bmsInternalTempC = (uint8_t)dbc_bms_msgid_0_x6_b3.internal_temperature_decode();      //1 byte
-  thermistorHighTempC = (uint8_t)dbc_bms_msgid_0_x6_b1.high_temperature_decode();       //1 byte
-  thermistorLowTempC = (uint8_t)dbc_bms_msgid_0_x6_b1.low_temperature_decode();         //1 byte
-
-  j1772PlugState = (bool)dbc_bms_msgid_0_x6_b3.j1772_plug_state_decode();               //1 bit
-  j1772ACCurrentLimit = (uint8_t)dbc_bms_msgid_0_x6_b3.j1772_ac_current_limit_decode(); //1 byte
-  j1772ACVoltage = (uint8_t)dbc_bms_msgid_0_x6_b5.j1772_ac_voltage_decode();            //1 byte
+  bool registered = dispatcher.addHandler(packStatsAddr, &CAN_Dispatcher::memberHandler<OrionBMS, &OrionBMS::receivePackStats>, this);
+  registered &= dispatcher.addHandler(cellStatsDTCAddr, &CAN_Dispatcher::memberHandler<OrionBMS, &OrionBMS::receiveCellStatsDTC>, this);
+  registered &= dispatcher.addHandler(currentLimitTempAddr, &CAN_Dispatcher::memberHandler<OrionBMS, &OrionBMS::receiveCurrentLimitAndTemp>, this);
+  registered &= dispatcher.addHandler(j1772Addr, &CAN_Dispatcher::memberHandler<OrionBMS, &OrionBMS::receiveJ1772Stats>, this);
+  return registered;
+}
 
+void OrionBMS::receiveHVCANData(const LV_CANMessage &msg)
+{
+  // Each message is unpacked into its DBC struct and only the fields it carries are updated. The fields are filled from the raw DBC
+  // signals with integer scaling instead of the *_decode() functions, which go through double.
+  uint32_t changed = 0;
+  switch(msg.addr){
+    case DBC_BMS_MSGID_0_X6_B0_FRAME_ID:    // Pack statistics
+      dbc_bms_msgid_0_x6_b0.unpack(msg.data(), 8);
+      updateField(packCurrentDeciAmps, dbc_bms_msgid_0_x6_b0.pack_current, BMS_FIELD_PACK_CURRENT, changed);                //2 bytes, 0.1A on both buses
+      updateField(packDeciVolts, dbc_bms_msgid_0_x6_b0.pack_inst_voltage, BMS_FIELD_PACK_VOLTAGE, changed);                 //2 bytes, 0.1V on both buses
+      updateField(packSOC, dbc_bms_msgid_0_x6_b0.pack_soc >> 1, BMS_FIELD_PACK_SOC, changed);                               //1 byte, 0.5% on the HV bus
+      //teleP->bms_pack_soc = float_map(teleP->bms_pack_inst_voltage / 104, 2.55, 4, 0, 100);
+      break;
+    case DBC_BMS_MSGID_0_X6_B1_FRAME_ID:    // Current limits and thermistor temperatures
+      dbc_bms_msgid_0_x6_b1.unpack(msg.data(), 8);
+      updateField(dischargeCurrentLimit, dbc_bms_msgid_0_x6_b1.pack_dcl, BMS_FIELD_DISCHARGE_LIMIT, changed);               //2 bytes
+      updateField(chargeCurrentLimit, dbc_bms_msgid_0_x6_b1.pack_ccl, BMS_FIELD_CHARGE_LIMIT, changed);                     //2 bytes
+      updateField(thermistorHighTempC, dbc_bms_msgid_0_x6_b1.high_temperature, BMS_FIELD_THERMISTOR_HIGH, changed);         //1 byte
+      updateField(thermistorLowTempC, dbc_bms_msgid_0_x6_b1.low_temperature, BMS_FIELD_THERMISTOR_LOW, changed);            //1 byte
+      break;
+    case DBC_BMS_MSGID_0_X6_B2_FRAME_ID:    // Amp hours and resistance
+      dbc_bms_msgid_0_x6_b2.unpack(msg.data(), 8);
+      updateField(packDeciAmpHours, dbc_bms_msgid_0_x6_b2.pack_amphours, BMS_FIELD_PACK_AMP_HOURS, changed);                //1 byte, 0.1Ah on both buses
+      updateField(packResistanceMilliOhms, dbc_bms_msgid_0_x6_b2.pack_resistance, BMS_FIELD_PACK_RESISTANCE, changed);      //1 byte, 1mOhm on both buses
+      break;
+    case DBC_BMS_MSGID_0_X6_B3_FRAME_ID:    // Low cell, BMS temperatures and J1772
+      dbc_bms_msgid_0_x6_b3.unpack(msg.data(), 8);
+      //low_cell_voltage is not forwarded, see the 0x6B6 case
+      updateField(bmsAverageTempC, dbc_bms_msgid_0_x6_b3.average_temperature, BMS_FIELD_AVERAGE_TEMP, changed);             //1 byte
+      updateField(bmsInternalTempC, dbc_bms_msgid_0_x6_b3.internal_temperature, BMS_FIELD_INTERNAL_TEMP, changed);          //1 byte
+      updateField(j1772PlugState, dbc_bms_msgid_0_x6_b3.j1772_plug_state != 0, BMS_FIELD_J1772_PLUG, changed);              //1 bit
+      updateField(j1772ACCurrentLimit, dbc_bms_msgid_0_x6_b3.j1772_ac_current_limit, BMS_FIELD_J1772_CURRENT_LIMIT, changed);   //1 byte
+      break;
+    case DBC_BMS_MSGID_0_X6_B4_FRAME_ID:    // Low cell resistance
+      dbc_bms_msgid_0_x6_b4.unpack(msg.data(), 8);
+      updateField(lowestCellResistanceDeci, dbc_bms_msgid_0_x6_b4.low_cell_resistance / 10, BMS_FIELD_LOW_CELL_RESISTANCE, changed);   //1 byte, 0.01mOhm on the HV bus
+      break;
+    case DBC_BMS_MSGID_0_X6_B5_FRAME_ID:    // Supply voltages
+      dbc_bms_msgid_0_x6_b5.unpack(msg.data(), 8);
+      updateField(inputSupplyDeciVolts, dbc_bms_msgid_0_x6_b5.input_supply_voltage, BMS_FIELD_INPUT_SUPPLY_VOLTAGE, changed);   //1 byte, 0.1V on both buses
+      updateField(j1772ACVoltage, dbc_bms_msgid_0_x6_b5.j1772_ac_voltage / 10, BMS_FIELD_J1772_VOLTAGE, changed);           //1 byte, 0.1V on the HV bus
+      break;
+    case DBC_BMS_MSGID_0_X6_B6_FRAME_ID:    // Cell voltages and DTC (Error) Codes
+      dbc_bms_msgid_0_x6_b6.unpack(msg.data(), 8);
+      //The cell voltages are not forwarded. DBC_BMS.dbc has them as 1 byte of 0.1mV (25.5mV full scale), which can't hold a cell voltage
+      //and would always be 0 in 0.1V. avgCellDeciVolts, highestCellDeciVolts and lowestCellDeciVolts stay as the application sets them.
+      updateField(dtcFlags1, dbc_bms_msgid_0_x6_b6.dtc_flags_1, BMS_FIELD_DTC_FLAGS_1, changed);                            //2 bytes
+      updateField(dtcFlags2, dbc_bms_msgid_0_x6_b6.dtc_flags_2, BMS_FIELD_DTC_FLAGS_2, changed);                            //2 bytes
+      break;
+    default:
+      return;                               // Not a BMS message this class uses
+  }
+  lastHVReceiveUs = msg.receivedAtUs();
+  updateFloatFields(changed);
+  changedFields |= changed;
 }
 
 RMSController::RMSController(uint32_t powerStatAddress, uint32_t motorTempAddress, uint32_t faultsAddress)
@@ -209,18 +282,21 @@ RMSController::RMSController(uint32_t powerStatAddress, uint32_t motorTempAddres
   powerStatAddr = powerStatAddress;
   motorTempAddr = motorTempAddress;
   faultsAddr = faultsAddress;
+  lastHVReceiveUs = 0;
+  forwardLatencyUs = 0;
 }
 
 void RMSController::initialize()
 {
-  accessoryVoltage = 0.0;            //12V reference voltage
-  busVoltage = 0.0;                   //DC bus voltage
-  busCurrent = 0.0;                   //DC bus current
-  rmsPhaseACurrent = 0.0;             //Phase A current
+  accessoryCentiVolts = 0;            //12V reference voltage
+  busDeciVolts = 0;                   //DC bus voltage
+  busDeciAmps = 0;                    //DC bus current
+  phaseADeciAmps = 0;                 //Phase A current
   motorRPM = 0;                       //Motor RPM
-  commandedTorque = 0.0;              //Commanded torque
-  motorTemperatureC = 0.0;            //Motor temperature in degrees C
-  inverterTemperatureC = 0.0;         //Inverter temperature in degrees C
+  commandedTorqueDeciNm = 0;          //Commanded torque
+  motorTemperatureDeciC = 0;          //Motor temperature in degrees C
+  inverterTemperatureDeciC = 0;       //Inverter temperature in degrees C
+  updateFloatFields(RMS_FIELD_ALL);   //Zero the float fields too
   postFaultHigh = 0;                  //Post fault high code
   postFaultLow = 0;                   //Post fault low code
   runFaultHigh = 0;                   //Run fault high code
@@ -229,34 +305,58 @@ void RMSController::initialize()
   powerStatsReceived = false;         //Flag indicating if power statistics have been received
   motorTempReceived = false;         //Flag indicating if motor temperature has been received
   faultsReceived = false;            //Flag indicating if fault codes have been received
+  changedFields = 0;
 }
 
-void RMSController::sendPowerStats(CAN_Controller &controller)
+/// @brief [Internal Function] In float mode, converts the float fields the application changed into the fixed-point fields that are encoded onto
+/// the LV CAN Bus, so code that sets the floats still sends what it set. Does nothing when HV_FIXED_POINT is set.
+void RMSController::scaleFloatFields()
+{
+#if !HV_FIXED_POINT
+  scaleField(accessoryCentiVolts, accessoryVoltage, 100.0f);                    //Convert to 0.01V increments
+  scaleField(busDeciVolts, busVoltage, 10.0f);                                  //Convert to 0.1V increments
+  scaleField(busDeciAmps, busCurrent, 10.0f);                                   //Convert to 0.1A increments
+  scaleField(phaseADeciAmps, rmsPhaseACurrent, 10.0f);                          //Convert to 0.1A increments
+  scaleField(motorTemperatureDeciC, motorTemperatureC, 10.0f);                  //Convert to 0.1C increments
+  scaleField(inverterTemperatureDeciC, inverterTemperatureC, 10.0f);            //Convert to 0.1C increments
+  scaleField(commandedTorqueDeciNm, commandedTorque, 10.0f);                    //Convert to 0.1Nm increments
+#endif
+}
+
+/// @brief [Internal Function] In float mode, recalculates the float fields from the fixed-point fields after they were decoded. Does nothing
+/// when HV_FIXED_POINT is set, where the float accessors calculate on demand instead.
+/// @param fields RMS_FIELD_* bits of the fields that changed. Only their floats are recalculated.
+void RMSController::updateFloatFields(uint32_t fields)
 {
-  uint16_t busVoltageTemp = (uint16_t)(busVoltage * 10);                    //Convert to 0.1V increments
-  uint16_t busCurrentTemp = (uint16_t)(busCurrent * 10);                    //Convert to 0.1A increments
-  uint16_t accessoryVoltageTemp = (uint16_t)(accessoryVoltage * 100);       //Convert to 0.01V increments
-  uint16_t phACurrentTemp = (uint16_t)(rmsPhaseACurrent * 10);              //Convert to 0.1A increments
+#if !HV_FIXED_POINT
+  if(fields & RMS_FIELD_ACCESSORY_VOLTAGE) accessoryVoltage = accessoryCentiVolts / 100.0f;               //Convert to volts
+  if(fields & RMS_FIELD_BUS_VOLTAGE) busVoltage = busDeciVolts / 10.0f;                                   //Convert to volts
+  if(fields & RMS_FIELD_BUS_CURRENT) busCurrent = busDeciAmps / 10.0f;                                    //Convert to amps
+  if(fields & RMS_FIELD_PHASE_A_CURRENT) rmsPhaseACurrent = phaseADeciAmps / 10.0f;                       //Convert to amps
+  if(fields & RMS_FIELD_MOTOR_TEMP) motorTemperatureC = motorTemperatureDeciC / 10.0f;                    //Convert to degrees C
+  if(fields & RMS_FIELD_INVERTER_TEMP) inverterTemperatureC = inverterTemperatureDeciC / 10.0f;           //Convert to degrees C
+  if(fields & RMS_FIELD_COMMANDED_TORQUE) commandedTorque = commandedTorqueDeciNm / 10.0f;                //Convert to Nm
+#else
+  (void)fields;                             //Unused, the accessors convert on demand
+#endif
+}
 
+void RMSController::sendPowerStats(CAN_Controller &controller)
+{
   controller.CANSend(powerStatAddr, 
-    (uint8_t)(accessoryVoltageTemp >> 8), (uint8_t)(accessoryVoltageTemp & 0xFF),
-    (uint8_t)(busVoltageTemp >> 8), (uint8_t)(busVoltageTemp & 0xFF),
-    (uint8_t)(busCurrentTemp >> 8), (uint8_t)(busCurrentTemp & 0xFF), 
-    (uint8_t)(phACurrentTemp >> 8), (uint8_t)(phACurrentTemp & 0xFF));       //Phase A current is already in 0.1A increments
+    (uint8_t)(accessoryCentiVolts >> 8), (uint8_t)(accessoryCentiVolts & 0xFF),
+    (uint8_t)(busDeciVolts >> 8), (uint8_t)(busDeciVolts & 0xFF),
+    (uint8_t)(busDeciAmps >> 8), (uint8_t)(busDeciAmps & 0xFF), 
+    (uint8_t)(phaseADeciAmps >> 8), (uint8_t)(phaseADeciAmps & 0xFF));       //Already in the LV bus increments
 }
 
 void RMSController::sendMotorTemp(CAN_Controller &controller)
 {
-  uint16_t motorRPMTemp = (uint16_t)motorRPM;                                //Motor RPM is already in 1 RPM increments
-  uint16_t motorTemperatureTemp = (uint16_t)(motorTemperatureC * 10);        //Convert to 0.1C increments
-  uint16_t inverterTemperatureTemp = (uint16_t)(inverterTemperatureC * 10);  //Convert to 0.1C increments
-  uint16_t commandedTorqueTemp = (uint16_t)(commandedTorque * 10);           //Convert to 0.1Nm increments
-
   controller.CANSend(motorTempAddr, 
-    (uint8_t)(motorRPMTemp >> 8), (uint8_t)(motorRPMTemp & 0xFF),
-    (uint8_t)(motorTemperatureTemp >> 8), (uint8_t)(motorTemperatureTemp & 0xFF),
-    (uint8_t)(inverterTemperatureTemp >> 8), (uint8_t)(inverterTemperatureTemp & 0xFF), 
-    (uint8_t)(commandedTorqueTemp >> 8), (uint8_t)(commandedTorqueTemp & 0xFF));    //Commanded torque is already in Nm increments
+    (uint8_t)(motorRPM >> 8), (uint8_t)(motorRPM & 0xFF),
+    (uint8_t)(motorTemperatureDeciC >> 8), (uint8_t)(motorTemperatureDeciC & 0xFF),
+    (uint8_t)(inverterTemperatureDeciC >> 8), (uint8_t)(inverterTemperatureDeciC & 0xFF), 
+    (uint8_t)(commandedTorqueDeciNm >> 8), (uint8_t)(commandedTorqueDeciNm & 0xFF));    //Already in the LV bus increments
 }
 
 void RMSController::sendFaults(CAN_Controller &controller)
@@ -270,103 +370,125 @@ void RMSController::sendFaults(CAN_Controller &controller)
 
 void RMSController::sendCANData(CAN_Controller &controller)
 {
+  scaleFloatFields();                     //Pick up any float fields set by the application
+  controller.beginTxBurst();              //Load all three frames into the CAN controller together
   sendPowerStats(controller);            //Sends the power statistics to the LV CAN Bus
   sendMotorTemp(controller);              //Sends the motor statistics and inverter temperature to the LV CAN Bus
   sendFaults(controller);                 //Sends the fault codes to the LV CAN Bus
+  controller.endTxBurst();
+  if(lastHVReceiveUs) forwardLatencyUs = micros() - lastHVReceiveUs;   //How long the newest HV data waited before going out on the LV bus
 }
 
-void RMSController::receivePowerStats(LV_CANMessage msg)
+void RMSController::receivePowerStats(const LV_CANMessage &msg)
 {
   if (msg.addr != powerStatAddr) return; //Ignore messages not meant for this address
 
-  uint16_t accessoryVoltageTemp = (uint16_t)(msg.byte0 << 8 | msg.byte1);            //Convert to 0.01V increments
-  uint16_t busVoltageTemp = (uint16_t)(msg.byte2 << 8 | msg.byte3);                  //Convert to 0.1V increments
-  uint16_t busCurrentTemp = (uint16_t)(msg.byte4 << 8 | msg.byte5);                  //Convert to 0.1A increments
-  uint16_t phACurrentTemp = (uint16_t)(msg.byte6 << 8 | msg.byte7);                  //Convert to 0.1A increments
-
-  accessoryVoltage = (float)(accessoryVoltageTemp / 100.0);                          //Convert to volts
-  busVoltage = (float)(busVoltageTemp / 10.0);                                        //Convert to volts
-  busCurrent = (float)(busCurrentTemp / 10.0);                                        //Convert to amps
-  rmsPhaseACurrent = (float)(phACurrentTemp / 10.0);                                  //Convert to amps
+  uint32_t changed = 0;
+  updateField(accessoryCentiVolts, msg.getBits<48, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_ACCESSORY_VOLTAGE, changed);   //0.01V increments
+  updateField(busDeciVolts, msg.getBits<32, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_BUS_VOLTAGE, changed);                //0.1V increments
+  updateField(busDeciAmps, msg.getBits<16, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_BUS_CURRENT, changed);                 //0.1A increments, negative while regenerating
+  updateField(phaseADeciAmps, msg.getBits<0, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_PHASE_A_CURRENT, changed);           //0.1A increments
+  updateFloatFields(changed);
+  changedFields |= changed;
 
   powerStatsReceived = true;                                                          //Set the flag to true to indicate that power stats have been received
+  receiveClock.stamp(msg);
 }
 
-void RMSController::receiveMotorTemp(LV_CANMessage msg)
+void RMSController::receiveMotorTemp(const LV_CANMessage &msg)
 {
   if (msg.addr != motorTempAddr) return; //Ignore messages not meant for this address
 
-  uint16_t motorRPMTemp = (uint16_t)(msg.byte0 << 8 | msg.byte1);                    //Motor RPM is already in 1 RPM increments
-  uint16_t motorTemperatureTemp = (uint16_t)(msg.byte2 << 8 | msg.byte3);            //Convert to 0.1C increments
-  uint16_t inverterTemperatureTemp = (uint16_t)(msg.byte4 << 8 | msg.byte5);          //Convert to 0.1C increments
-  uint16_t commandedTorqueTemp = (uint16_t)(msg.byte6 << 8 | msg.byte7);             //Convert to 0.1Nm increments
-
-  motorRPM = (uint16_t)motorRPMTemp;                                                 //Motor RPM is already in 1 RPM increments
-  motorTemperatureC = (float)(motorTemperatureTemp / 10.0);                          //Convert to degrees C
-  inverterTemperatureC = (float)(inverterTemperatureTemp / 10.0);                    //Convert to degrees C
-  commandedTorque = (float)(commandedTorqueTemp / 10.0);                             //Convert to Nm
+  uint32_t changed = 0;
+  updateField(motorRPM, msg.getBits<48, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_MOTOR_RPM, changed);                      //Motor RPM is already in 1 RPM increments
+  updateField(motorTemperatureDeciC, msg.getBits<32, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_MOTOR_TEMP, changed);        //0.1C increments
+  updateField(inverterTemperatureDeciC, msg.getBits<16, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_INVERTER_TEMP, changed);  //0.1C increments
+  updateField(commandedTorqueDeciNm, msg.getBits<0, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_COMMANDED_TORQUE, changed);   //0.1Nm increments, negative while regenerating
+  updateFloatFields(changed);
+  changedFields |= changed;
 
   motorTempReceived = true;                                                           //Set the flag to true to indicate that motor temp has been received
+  receiveClock.stamp(msg);
 }
 
-void RMSController::receiveFaults(LV_CANMessage msg)
+void RMSController::receiveFaults(const LV_CANMessage &msg)
 {
   if (msg.addr != faultsAddr) return; //Ignore messages not meant for this address
 
-  uint16_t postFaultHighTemp = (uint16_t)(msg.byte0 << 8 | msg.byte1);               //Post fault high code
-  uint16_t postFaultLowTemp = (uint16_t)(msg.byte2 << 8 | msg.byte3);                //Post fault low code
-  uint16_t runFaultHighTemp = (uint16_t)(msg.byte4 << 8 | msg.byte5);                 //Run fault high code
-  uint16_t runFaultLowTemp = (uint16_t)(msg.byte6 << 8 | msg.byte7);                  //Run fault low code
-
-  postFaultHigh = (uint16_t)postFaultHighTemp;                                        //Post fault high code
-  postFaultLow = (uint16_t)postFaultLowTemp;                                          //Post fault low code
-  runFaultHigh = (uint16_t)runFaultHighTemp;                                          //Run fault high code
-  runFaultLow = (uint16_t)runFaultLowTemp;                                            //Run fault low code
+  uint32_t changed = 0;
+  updateField(postFaultHigh, msg.getBits<48, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_POST_FAULT_HIGH, changed);           //Post fault high code
+  updateField(postFaultLow, msg.getBits<32, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_POST_FAULT_LOW, changed);             //Post fault low code
+  updateField(runFaultHigh, msg.getBits<16, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_RUN_FAULT_HIGH, changed);             //Run fault high code
+  updateField(runFaultLow, msg.getBits<0, 16, CAN_BIG_ENDIAN>(), RMS_FIELD_RUN_FAULT_LOW, changed);                //Run fault low code
+  changedFields |= changed;
 
   faultsReceived = true;                                                              //Set the flag to true to indicate that faults have been received
+  receiveClock.stamp(msg);
 }
 
-void RMSController::receiveCANData(LV_CANMessage msg)
+void RMSController::receiveCANData(const LV_CANMessage &msg)
 {
   receivePowerStats(msg);            //Receives the power statistics from the board translating from the HV Bus and parses it into this object
   receiveMotorTemp(msg);              //Receives the motor statistics and inverter temperature from the board translating from the HV Bus and parses it into this object
   receiveFaults(msg);                 //Receives the fault codes from the board translating from the HV Bus and parses it into this object
 }
 
-void RMSController::receiveHVCANData(LV_CANMessage msg)
+bool RMSController::registerReceive(CAN_Dispatcher &dispatcher)
 {
+  bool registered = dispatcher.addHandler(powerStatAddr, &CAN_Dispatcher::memberHandler<RMSController, &RMSController::receivePowerStats>, this);
+  registered &= dispatcher.addHandler(motorTempAddr, &CAN_Dispatcher::memberHandler<RMSController, &RMSController::receiveMotorTemp>, this);
+  registered &= dispatcher.addHandler(faultsAddr, &CAN_Dispatcher::memberHandler<RMSController, &RMSController::receiveFaults>, this);
+  return registered;
+}
 
-  auto rms = rmscanmap.find(msg.addr);
-  if (rms != rmscanmap.end())
-  {
-    // Found the ID in the RMS CAN Map
-    // The unpack will automatically feed the message into the appropriate struct for parsing the data
-    // Conversion from LV_CANMessage to uint8_t array for unpacking
-    uint8_t data[8] = {msg.byte0, msg.byte1, msg.byte2, msg.byte3, msg.byte4, msg.byte5, msg.byte6, msg.byte7};
-    rms->second->unpack(data, msg.addr);
-    return;
+void RMSController::receiveHVCANData(const LV_CANMessage &msg)
+{
+  // Each message is unpacked into its DBC struct and only the fields it carries are updated. The fields are filled from the raw DBC
+  // signals instead of the *_decode() functions, which go through double. The RMS already sends every value in the increments used on the LV bus.
+  uint32_t changed = 0;
+  switch(msg.addr){
+    case DBC_RMS_M169_INTERNAL_VOLTAGES_FRAME_ID:
+      dbc_rms_m169_internal_voltages.unpack(msg.data(), 8);
+      updateField(accessoryCentiVolts, dbc_rms_m169_internal_voltages.d4_reference_voltage_12_0, RMS_FIELD_ACCESSORY_VOLTAGE, changed);     // 2 bytes, 0.01V
+      break;
+    case DBC_RMS_M167_VOLTAGE_INFO_FRAME_ID:
+      dbc_rms_m167_voltage_info.unpack(msg.data(), 8);
+      updateField(busDeciVolts, dbc_rms_m167_voltage_info.d1_dc_bus_voltage, RMS_FIELD_BUS_VOLTAGE, changed);                              // 2 bytes, 0.1V
+      break;
+    case DBC_RMS_M166_CURRENT_INFO_FRAME_ID:
+      dbc_rms_m166_current_info.unpack(msg.data(), 8);
+      updateField(busDeciAmps, dbc_rms_m166_current_info.d4_dc_bus_current, RMS_FIELD_BUS_CURRENT, changed);                               // 2 bytes, 0.1A
+      updateField(phaseADeciAmps, dbc_rms_m166_current_info.d1_phase_a_current, RMS_FIELD_PHASE_A_CURRENT, changed);                       // 2 bytes, 0.1A
+      break;
+    case DBC_RMS_M165_MOTOR_POSITION_INFO_FRAME_ID:
+      dbc_rms_m165_motor_position_info.unpack(msg.data(), 8);
+      updateField(motorRPM, dbc_rms_m165_motor_position_info.d2_motor_speed, RMS_FIELD_MOTOR_RPM, changed);                                // 2 bytes, 1 RPM
+      break;
+    case DBC_RMS_M172_TORQUE_AND_TIMER_INFO_FRAME_ID:
+      dbc_rms_m172_torque_and_timer_info.unpack(msg.data(), 8);
+      updateField(commandedTorqueDeciNm, dbc_rms_m172_torque_and_timer_info.d1_commanded_torque, RMS_FIELD_COMMANDED_TORQUE, changed);     // 2 bytes, 0.1Nm
+      break;
+    case DBC_RMS_M162_TEMPERATURE_SET_3_FRAME_ID:
+      dbc_rms_m162_temperature_set_3.unpack(msg.data(), 8);
+      updateField(motorTemperatureDeciC, dbc_rms_m162_temperature_set_3.d3_motor_temperature, RMS_FIELD_MOTOR_TEMP, changed);              // 2 bytes, 0.1C
+      break;
+    case DBC_RMS_M161_TEMPERATURE_SET_2_FRAME_ID:
+      dbc_rms_m161_temperature_set_2.unpack(msg.data(), 8);
+      updateField(inverterTemperatureDeciC, dbc_rms_m161_temperature_set_2.d1_control_board_temperature, RMS_FIELD_INVERTER_TEMP, changed);   // 2 bytes, 0.1C
+      break;
+    case DBC_RMS_M171_FAULT_CODES_FRAME_ID:
+      dbc_rms_m171_fault_codes.unpack(msg.data(), 8);
+      updateField(postFaultHigh, dbc_rms_m171_fault_codes.d2_post_fault_hi, RMS_FIELD_POST_FAULT_HIGH, changed);                           // 2 bytes
+      updateField(postFaultLow, dbc_rms_m171_fault_codes.d1_post_fault_lo, RMS_FIELD_POST_FAULT_LOW, changed);                             // 2 bytes
+      updateField(runFaultHigh, dbc_rms_m171_fault_codes.d4_run_fault_hi, RMS_FIELD_RUN_FAULT_HIGH, changed);                              // 2 bytes
+      updateField(runFaultLow, dbc_rms_m171_fault_codes.d3_run_fault_lo, RMS_FIELD_RUN_FAULT_LOW, changed);                                // 2 bytes
+      faultActive = (runFaultLow > 0) || (postFaultLow > 0) || (postFaultHigh > 0); //Set the faultActive flag if any of the fault codes are non-zero
+      break;
+    //teleP->rms_motor_speed = (float)dbc_rms_m176_fast_info.fast_motor_speed_decode();
+    default:
+      return;                               // Not an RMS message this class uses
   }
-
-  //RMS Voltages and Currents
-  accessoryVoltage = (float)dbc_rms_m169_internal_voltages.d4_reference_voltage_12_0_decode();            // 2 bytes
-  busVoltage = (float)dbc_rms_m167_voltage_info.d1_dc_bus_voltage_decode();		                            // 2 bytes
-  busCurrent = (float)dbc_rms_m166_current_info.d4_dc_bus_current_decode();                               // 2 bytes
-  rmsPhaseACurrent = (float)dbc_rms_m166_current_info.d1_phase_a_current_decode();                        // 2 bytes
-
-  //Motor and Temperature Info
-  motorRPM = (uint16_t)dbc_rms_m165_motor_position_info.d2_motor_speed_decode();                          // 2 bytes
-  commandedTorque = dbc_rms_m172_torque_and_timer_info.d1_commanded_torque_decode();                      // 2 bytes
-  motorTemperatureC = (float)dbc_rms_m162_temperature_set_3.d3_motor_temperature_decode();                // 2 bytes
-  inverterTemperatureC = (float)dbc_rms_m161_temperature_set_2.d1_control_board_temperature_decode();     // 2 bytes
-
-  // RMS Run Faults
-  postFaultHigh = (uint16_t)dbc_rms_m171_fault_codes.d2_post_fault_hi_decode();                           // 2 bytes
-  postFaultLow = (uint16_t)dbc_rms_m171_fault_codes.d1_post_fault_lo_decode();                            // 2 bytes
-  runFaultHigh = (uint16_t)dbc_rms_m171_fault_codes.d4_run_fault_hi_decode();                             // 2 bytes
-  runFaultLow = (uint16_t)dbc_rms_m171_fault_codes.d3_run_fault_lo_decode();                              // 2 bytes
-
-  //teleP->rms_motor_speed = (float)dbc_rms_m176_fast_info.fast_motor_speed_decode();
-  //Serial.println(teleP->rms_motor_speed);
-
-  faultActive = (runFaultLow > 0) || (postFaultLow > 0) || (postFaultHigh > 0); //Set the faultActive flag if any of the fault codes are non-zero
+  lastHVReceiveUs = msg.receivedAtUs();
+  updateFloatFields(changed);
+  changedFields |= changed;
 }
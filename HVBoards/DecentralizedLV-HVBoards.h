@@ -42,7 +42,53 @@
 #include "DecentralizedLV-Boards/HVBoards/dbc_bms.h"
 #include "DecentralizedLV-Boards/HVBoards/canstruct.h"
 #include "vector"
-#include "map"
+
+//Set to 1 to drop the float fields of OrionBMS and RMSController and read them through float accessor functions of the same name instead,
+//e.g. 'bms.packCurrentAmps()'. Encoding and decoding always work on the fixed-point fields (packCurrentDeciAmps, busDeciVolts, ...),
+//so in this mode no float math runs unless an accessor is called. Worth it on the Photon, whose STM32F2 has no FPU.
+//Define it for the whole project (library and application) so both see the same class layout.
+#ifndef HV_FIXED_POINT
+#define HV_FIXED_POINT 0
+#endif
+
+//Bits of OrionBMS::changedFields, one per field filled in from the CAN Bus
+#define BMS_FIELD_PACK_CURRENT          0x00000001UL    //packCurrentDeciAmps / packCurrentAmps
+#define BMS_FIELD_PACK_VOLTAGE          0x00000002UL    //packDeciVolts / packInstantaneousVoltage
+#define BMS_FIELD_PACK_SOC              0x00000004UL    //packSOC
+#define BMS_FIELD_INPUT_SUPPLY_VOLTAGE  0x00000008UL    //inputSupplyDeciVolts / inputSupplyVoltage
+#define BMS_FIELD_PACK_AMP_HOURS        0x00000010UL    //packDeciAmpHours / packAmpHours
+#define BMS_FIELD_PACK_RESISTANCE       0x00000020UL    //packResistanceMilliOhms / packResistanceOhms
+#define BMS_FIELD_AVG_CELL_VOLTAGE      0x00000040UL    //avgCellDeciVolts / avgCellVoltage
+#define BMS_FIELD_HIGH_CELL_VOLTAGE     0x00000080UL    //highestCellDeciVolts / highestCellVoltage
+#define BMS_FIELD_LOW_CELL_VOLTAGE      0x00000100UL    //lowestCellDeciVolts / lowestCellVoltage
+#define BMS_FIELD_LOW_CELL_RESISTANCE   0x00000200UL    //lowestCellResistanceDeci / lowestCellResistanceOhms
+#define BMS_FIELD_DTC_FLAGS_1           0x00000400UL    //dtcFlags1
+#define BMS_FIELD_DTC_FLAGS_2           0x00000800UL    //dtcFlags2
+#define BMS_FIELD_DISCHARGE_LIMIT       0x00001000UL    //dischargeCurrentLimit
+#define BMS_FIELD_CHARGE_LIMIT          0x00002000UL    //chargeCurrentLimit
+#define BMS_FIELD_AVERAGE_TEMP          0x00004000UL    //bmsAverageTempC
+#define BMS_FIELD_INTERNAL_TEMP         0x00008000UL    //bmsInternalTempC
+#define BMS_FIELD_THERMISTOR_HIGH       0x00010000UL    //thermistorHighTempC
+#define BMS_FIELD_THERMISTOR_LOW        0x00020000UL    //thermistorLowTempC
+#define BMS_FIELD_J1772_PLUG            0x00040000UL    //j1772PlugState
+#define BMS_FIELD_J1772_CURRENT_LIMIT   0x00080000UL    //j1772ACCurrentLimit
+#define BMS_FIELD_J1772_VOLTAGE         0x00100000UL    //j1772ACVoltage
+#define BMS_FIELD_ALL                   0x001FFFFFUL
+
+//Bits of RMSController::changedFields, one per field filled in from the CAN Bus
+#define RMS_FIELD_ACCESSORY_VOLTAGE     0x0001          //accessoryCentiVolts / accessoryVoltage
+#define RMS_FIELD_BUS_VOLTAGE           0x0002          //busDeciVolts / busVoltage
+#define RMS_FIELD_BUS_CURRENT           0x0004          //busDeciAmps / busCurrent
+#define RMS_FIELD_PHASE_A_CURRENT       0x0008          //phaseADeciAmps / rmsPhaseACurrent
+#define RMS_FIELD_COMMANDED_TORQUE      0x0010          //commandedTorqueDeciNm / commandedTorque
+#define RMS_FIELD_MOTOR_TEMP            0x0020          //motorTemperatureDeciC / motorTemperatureC
+#define RMS_FIELD_INVERTER_TEMP         0x0040          //inverterTemperatureDeciC / inverterTemperatureC
+#define RMS_FIELD_MOTOR_RPM             0x0080          //motorRPM
+#define RMS_FIELD_POST_FAULT_HIGH       0x0100          //postFaultHigh
+#define RMS_FIELD_POST_FAULT_LOW        0x0200          //postFaultLow
+#define RMS_FIELD_RUN_FAULT_HIGH        0x0400          //runFaultHigh
+#define RMS_FIELD_RUN_FAULT_LOW         0x0800          //runFaultLow
+#define RMS_FIELD_ALL                   0x0FFF
 
 //Class to represent the Orion BMS on the Low Voltage CAN Bus. This class contains only necessary info that will be parsed from the HV CAN Bus
 class OrionBMS {
@@ -56,18 +102,7 @@ class OrionBMS {
     dbc_bms_msgid_0_x6_b4_t dbc_bms_msgid_0_x6_b4;
     dbc_bms_msgid_0_x6_b5_t dbc_bms_msgid_0_x6_b5;
     dbc_bms_msgid_0_x6_b6_t dbc_bms_msgid_0_x6_b6;
-
     // Missing the CELLBCAST message since that re-uses the same struct memebers and will get rewriten for each cellid.
-    std::map<int, CAN_STRUCT*> bmscanmap =
-    {
-      {DBC_BMS_MSGID_0_X6_B0_FRAME_ID, &dbc_bms_msgid_0_x6_b0},
-      {DBC_BMS_MSGID_0_X6_B1_FRAME_ID, &dbc_bms_msgid_0_x6_b1},
-      {DBC_BMS_MSGID_0_X6_B2_FRAME_ID, &dbc_bms_msgid_0_x6_b2},
-      {DBC_BMS_MSGID_0_X6_B3_FRAME_ID, &dbc_bms_msgid_0_x6_b3},
-      {DBC_BMS_MSGID_0_X6_B4_FRAME_ID, &dbc_bms_msgid_0_x6_b4},
-      {DBC_BMS_MSGID_0_X6_B5_FRAME_ID, &dbc_bms_msgid_0_x6_b5},
-      {DBC_BMS_MSGID_0_X6_B6_FRAME_ID, &dbc_bms_msgid_0_x6_b6}
-    };
 
     uint32_t packStatsAddr;             //CAN address for the pack statistics
     uint32_t cellStatsDTCAddr;          //CAN address for the cell statistics and DTC error codes
@@ -79,12 +114,36 @@ class OrionBMS {
     void sendCurrentLimitAndTemp(CAN_Controller &controller);   //Sends the current limits and temperatures to the LV CAN Bus
     void sendJ1772Stats(CAN_Controller &controller);            //Sends the J1772 charger status to the LV CAN Bus
 
-    void receivePackStats(LV_CANMessage msg);                   //Receives the pack statistics from the board translating from the HV Bus and parses it into this object
-    void receiveCellStatsDTC(LV_CANMessage msg);                //Receives the cell statistics and DTC error codes from the board translating from the HV Bus and parses it into this object
-    void receiveCurrentLimitAndTemp(LV_CANMessage msg);         //Receives the current limits and temperatures from the board translating from the HV Bus and parses it into this object
-    void receiveJ1772Stats(LV_CANMessage msg);                  //Receives the J1772 charger status from the board translating from the HV Bus and parses it into this object
+    void receivePackStats(const LV_CANMessage &msg);                   //Receives the pack statistics from the board translating from the HV Bus and parses it into this object
+    void receiveCellStatsDTC(const LV_CANMessage &msg);                //Receives the cell statistics and DTC error codes from the board translating from the HV Bus and parses it into this object
+    void receiveCurrentLimitAndTemp(const LV_CANMessage &msg);         //Receives the current limits and temperatures from the board translating from the HV Bus and parses it into this object
+    void receiveJ1772Stats(const LV_CANMessage &msg);                  //Receives the J1772 charger status from the board translating from the HV Bus and parses it into this object
+    void scaleFloatFields();            //Float mode only: converts the float fields into the fixed-point fields before sending
+    void updateFloatFields(uint32_t fields);    //Float mode only: recalculates the float fields whose FIELD bits are set, after decoding
 
     public:
+    //Fixed-point pack measurements, in the units they are sent on the LV CAN Bus. Read these instead of the floats to avoid float math.
+    uint16_t packCurrentDeciAmps;       //Pack current in 0.1A
+    uint16_t packDeciVolts;             //Pack voltage in 0.1V
+    uint8_t inputSupplyDeciVolts;       //12V supply voltage of the BMS in 0.1V
+    uint8_t avgCellDeciVolts;           //Average cell voltage in 0.1V. Not decoded from the HV bus, see receiveHVCANData.
+    uint8_t highestCellDeciVolts;       //Highest cell voltage in 0.1V. Not decoded from the HV bus, see receiveHVCANData.
+    uint8_t lowestCellDeciVolts;        //Lowest cell voltage in 0.1V. Not decoded from the HV bus, see receiveHVCANData.
+    uint8_t packDeciAmpHours;           //Pack amp hours in 0.1Ah
+    uint8_t packResistanceMilliOhms;    //Pack resistance in mOhm
+    uint8_t lowestCellResistanceDeci;   //Resistance of the lowest cell in 0.1mOhm
+
+#if HV_FIXED_POINT
+    float packCurrentAmps(){ return packCurrentDeciAmps * 0.1f; }               //Current number of amps being charged/discharged from the pack
+    float packInstantaneousVoltage(){ return packDeciVolts * 0.1f; }            //Raw voltage reading of the full pack
+    float inputSupplyVoltage(){ return inputSupplyDeciVolts * 0.1f; }           //12V voltage the BMS is getting
+    float avgCellVoltage(){ return avgCellDeciVolts * 0.1f; }                   //Average voltage of all the cells in the pack (calculated by the BMS)
+    float highestCellVoltage(){ return highestCellDeciVolts * 0.1f; }           //Highest voltage of any cell in the pack (calculated by the BMS)
+    float packAmpHours(){ return packDeciAmpHours * 0.1f; }                     //Amp hours of the pack (estimated by the BMS)
+    float packResistanceOhms(){ return packResistanceMilliOhms * 0.001f; }      //Resistance estimated by the BMS for the pack (estimated by the BMS)
+    float lowestCellVoltage(){ return lowestCellDeciVolts * 0.1f; }             //Lowest voltage of any cell in the pack (calculated by the BMS)
+    float lowestCellResistanceOhms(){ return lowestCellResistanceDeci * 0.0001f; } //Resistance of the lowest cell in the pack in ohms (calculated by the BMS)
+#else
     float packCurrentAmps;              //Current number of amps being charged/discharged from the pack
     float packInstantaneousVoltage;     //Raw voltage reading of the full pack
     float inputSupplyVoltage;           //12V voltage the BMS is getting
@@ -93,7 +152,8 @@ class OrionBMS {
     float packAmpHours;                 //Amp hours of the pack (estimated by the BMS)
     float packResistanceOhms;           //Resistance estimated by the BMS for the pack (estimated by the BMS)
     float lowestCellVoltage;            //Lowest voltage of any cell in the pack (calculated by the BMS)
-    float lowestCellResistanceOhms;     //Resistance of the lowest cell in the pack (calculated by the BMS)
+    float lowestCellResistanceOhms;     //Resistance of the lowest cell in the pack in ohms (calculated by the BMS)
+#endif
 
     uint8_t bmsAverageTempC;              //Average temperature of the thermistors on the BMS itself (not expansion)
     uint8_t bmsInternalTempC;             //Internal thermistor on the BMS
@@ -117,49 +177,35 @@ class OrionBMS {
     bool cellStatsDTCReceived;      //Flag set true in receiveCANData when a message from the Orion has been received. Use this on other boards to check if you're hearing from the Orion.
     bool currentLimitTempReceived;  //Flag set true in receiveCANData when a message from the Orion has been received. Use this on other boards to check if you're hearing from the Orion.
     bool j1772Received;             //Flag set true in receiveCANData when a message from the Orion has been received. Use this on other boards to check if you're hearing from the Orion.
+    uint32_t changedFields;         //BMS_FIELD_* bit set for each field whose value changed when a frame was decoded. Clear it once you've handled the changes.
+    CAN_ReceiveClock receiveClock;  //When the last LV frame was parsed by receiveCANData. Use dataAgeUs() to check how stale the fields are.
+    uint32_t lastHVReceiveUs;       //rxTimestampUs of the last HV frame parsed by receiveHVCANData.
+    uint32_t forwardLatencyUs;      //Time from the last HV frame arriving to sendCANData putting its data on the LV bus.
 
     OrionBMS(uint32_t packStatsAddress, uint32_t cellStatsDTCAddress, uint32_t currentLimitTempAddress, uint32_t j1772Address);
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    void receiveCANData(LV_CANMessage msg);     //Receives data from the HV Controller (or whichever board is translating the HV CAN Bus to the LV CAN Bus) and parses it into this object
-    void receiveHVCANData(LV_CANMessage msg);   //Takes messages from the HV CAN Bus and parses them into this object which can then be sent on the LV CAN Bus
+    void receiveCANData(const LV_CANMessage &msg);     //Receives data from the HV Controller (or whichever board is translating the HV CAN Bus to the LV CAN Bus) and parses it into this object
+    bool registerReceive(CAN_Dispatcher &dispatcher);  //Routes each of this object's LV CAN addresses straight to its parser through a CAN_Dispatcher
+    uint32_t dataAgeUs(){ return receiveClock.ageUs(); }                        //See CAN_ReceiveClock::ageUs
+    bool isFresh(uint32_t timeoutMs){ return receiveClock.isFresh(timeoutMs); }  //See CAN_ReceiveClock::isFresh. The *Received flags never go back to false.
+    void receiveHVCANData(const LV_CANMessage &msg);   //Takes messages from the HV CAN Bus and parses them into this object which can then be sent on the LV CAN Bus. Only the fields carried by msg are updated.
 };
 
 //Class to represent the Orion BMS on the Low Voltage CAN Bus. This class contains only necessary info that will be parsed from the HV CAN Bus
 class RMSController {
     private:
 
-    // RMS CANBUS Structs. These structs parse and decode CAN Bus messages.
-    dbc_rms_m192_command_message_t dbc_rms_m192_command_message;
+    // RMS CANBUS Structs. These structs parse and decode CAN Bus messages. Only the messages that feed a public field are kept.
     dbc_rms_m171_fault_codes_t dbc_rms_m171_fault_codes;
-    dbc_rms_m170_internal_states_t dbc_rms_m170_internal_states;
     dbc_rms_m169_internal_voltages_t dbc_rms_m169_internal_voltages;
     dbc_rms_m167_voltage_info_t dbc_rms_m167_voltage_info;
     dbc_rms_m166_current_info_t dbc_rms_m166_current_info;
     dbc_rms_m165_motor_position_info_t dbc_rms_m165_motor_position_info;
     dbc_rms_m162_temperature_set_3_t dbc_rms_m162_temperature_set_3;
     dbc_rms_m161_temperature_set_2_t dbc_rms_m161_temperature_set_2;
-    dbc_rms_m188_u2_c_message_rxd_t dbc_rms_m188_u2_c_message_rxd;
-    dbc_rms_bms_current_limit_t dbc_rms_bms_current_limit;
-    dbc_rms_m176_fast_info_t dbc_rms_m176_fast_info;
     dbc_rms_m172_torque_and_timer_info_t dbc_rms_m172_torque_and_timer_info;
 
-    std::map<int, CAN_STRUCT*> rmscanmap =
-    {
-      {DBC_RMS_M192_COMMAND_MESSAGE_FRAME_ID, &dbc_rms_m192_command_message},
-      {DBC_RMS_M171_FAULT_CODES_FRAME_ID, &dbc_rms_m171_fault_codes},
-      {DBC_RMS_M170_INTERNAL_STATES_FRAME_ID, &dbc_rms_m170_internal_states},
-      {DBC_RMS_M169_INTERNAL_VOLTAGES_FRAME_ID, &dbc_rms_m169_internal_voltages},
-      {DBC_RMS_M167_VOLTAGE_INFO_FRAME_ID, &dbc_rms_m167_voltage_info},
-      {DBC_RMS_M166_CURRENT_INFO_FRAME_ID, &dbc_rms_m166_current_info},
-      {DBC_RMS_M165_MOTOR_POSITION_INFO_FRAME_ID, &dbc_rms_m165_motor_position_info},
-      {DBC_RMS_M162_TEMPERATURE_SET_3_FRAME_ID, &dbc_rms_m162_temperature_set_3},
-      {DBC_RMS_M161_TEMPERATURE_SET_2_FRAME_ID, &dbc_rms_m161_temperature_set_2},
-      {DBC_RMS_M188_U2_C_MESSAGE_RXD_FRAME_ID, &dbc_rms_m188_u2_c_message_rxd},
-      {DBC_RMS_BMS_CURRENT_LIMIT_FRAME_ID, &dbc_rms_bms_current_limit},
-      {DBC_RMS_M176_FAST_INFO_FRAME_ID, &dbc_rms_m176_fast_info},
-      {DBC_RMS_M172_TORQUE_AND_TIMER_INFO_FRAME_ID, &dbc_rms_m172_torque_and_timer_info}
-    };
 
     uint32_t powerStatAddr;             //CAN address for the power statistics (accessory voltage, bus voltage, bus current, etc.)
     uint32_t motorTempAddr;             //CAN address for the motor statistics and inverter temperature
@@ -169,9 +215,11 @@ class RMSController {
     void sendMotorTemp(CAN_Controller &controller);              //Sends the motor statistics and inverter temperature to the LV CAN Bus
     void sendFaults(CAN_Controller &controller);                 //Sends the fault codes to the LV CAN Bus
     
-    void receivePowerStats(LV_CANMessage msg);                   //Receives the power statistics from the board translating from the HV Bus and parses it into this object
-    void receiveMotorTemp(LV_CANMessage msg);                    //Receives the motor statistics and inverter temperature from the board translating from the HV Bus and parses it into this object
-    void receiveFaults(LV_CANMessage msg);                       //Receives the fault codes from the board translating from the HV Bus and parses it into this object
+    void receivePowerStats(const LV_CANMessage &msg);                   //Receives the power statistics from the board translating from the HV Bus and parses it into this object
+    void receiveMotorTemp(const LV_CANMessage &msg);                    //Receives the motor statistics and inverter temperature from the board translating from the HV Bus and parses it into this object
+    void receiveFaults(const LV_CANMessage &msg);                       //Receives the fault codes from the board translating from the HV Bus and parses it into this object
+    void scaleFloatFields();            //Float mode only: converts the float fields into the fixed-point fields before sending
+    void updateFloatFields(uint32_t fields);    //Float mode only: recalculates the float fields whose FIELD bits are set, after decoding
 
     public:
 
@@ -181,6 +229,24 @@ class RMSController {
     uint16_t runFaultHigh;              //Upper bits of the run fault code. Check page 47 of the doc linked above for info.
     uint16_t runFaultLow;               //Lower bits of the run fault code. Check page 47 of the doc linked above for info.
 
+    //Fixed-point readings, in the units they are sent on the LV CAN Bus (and the RMS sends them on the HV CAN Bus). Read these instead of the floats to avoid float math.
+    int16_t accessoryCentiVolts;        //12V bus voltage in 0.01V
+    int16_t busDeciVolts;               //High voltage bus voltage in 0.1V
+    int16_t busDeciAmps;                //High voltage bus current in 0.1A
+    int16_t commandedTorqueDeciNm;      //Pedal commanded torque in 0.1Nm
+    int16_t phaseADeciAmps;             //Phase A current in 0.1A
+    int16_t motorTemperatureDeciC;      //Motor temperature in 0.1C
+    int16_t inverterTemperatureDeciC;   //Control board temperature in 0.1C
+
+#if HV_FIXED_POINT
+    float accessoryVoltage(){ return accessoryCentiVolts * 0.01f; }             //Reading of the 12V bus from the RMS.
+    float busVoltage(){ return busDeciVolts * 0.1f; }                           //Reading of the high voltage bus from the RMS.
+    float busCurrent(){ return busDeciAmps * 0.1f; }                            //Reading of the high voltage bus current from the RMS.
+    float commandedTorque(){ return commandedTorqueDeciNm * 0.1f; }             //Pedal commanded torque (Nm).
+    float rmsPhaseACurrent(){ return phaseADeciAmps * 0.1f; }                   //Reading of the phase A current from the RMS.
+    float motorTemperatureC(){ return motorTemperatureDeciC * 0.1f; }           //Reading of the motor temperature from the RMS.
+    float inverterTemperatureC(){ return inverterTemperatureDeciC * 0.1f; }     //Reading of the control board temperature from the RMS.
+#else
     float accessoryVoltage;             //Reading of the 12V bus from the RMS.
     float busVoltage;                   //Reading of the high voltage bus from the RMS.
     float busCurrent;                   //Reading of the high voltage bus current from the RMS.
@@ -188,6 +254,7 @@ class RMSController {
     float rmsPhaseACurrent;             //Reading of the phase A current from the RMS.
     float motorTemperatureC;            //Reading of the motor temperature from the RMS.
     float inverterTemperatureC;         //Reading of the control board temperature from the RMS.
+#endif
 
     uint16_t motorRPM;           //Reading of the motor RPM from the RMS. THIS IS NOT ALWAYS ACCURATE. Returns 0 when pedal is released.
 
@@ -196,10 +263,17 @@ class RMSController {
     bool powerStatsReceived;         //Flag set true in receiveCANData when a message from the RMS has been received. Use this on other boards to check if you're hearing from the RMS.
     bool motorTempReceived;         //Flag set true in receiveCANData when a message from the RMS has been received. Use this on other boards to check if you're hearing from the RMS.
     bool faultsReceived;            //Flag set true in receiveCANData when a message from the RMS has been received. Use this on other boards to check if you're hearing from the RMS.
+    uint16_t changedFields;         //RMS_FIELD_* bit set for each field whose value changed when a frame was decoded. Clear it once you've handled the changes.
+    CAN_ReceiveClock receiveClock;  //When the last LV frame was parsed by receiveCANData. Use dataAgeUs() to check how stale the fields are.
+    uint32_t lastHVReceiveUs;       //rxTimestampUs of the last HV frame parsed by receiveHVCANData.
+    uint32_t forwardLatencyUs;      //Time from the last HV frame arriving to sendCANData putting its data on the LV bus.
 
     RMSController(uint32_t powerStatAddress, uint32_t motorTempAddress, uint32_t faultsAddress);
     void initialize();
     void sendCANData(CAN_Controller &controller);
-    void receiveCANData(LV_CANMessage msg);     //Receives data from the HV Controller (or whichever board is translating the HV CAN Bus to the LV CAN Bus) and parses it into this object
-    void receiveHVCANData(LV_CANMessage msg);   //Takes messages from the HV CAN Bus and parses them into this object which can then be sent on the LV CAN Bus
+    void receiveCANData(const LV_CANMessage &msg);     //Receives data from the HV Controller (or whichever board is translating the HV CAN Bus to the LV CAN Bus) and parses it into this object
+    bool registerReceive(CAN_Dispatcher &dispatcher);  //Routes each of this object's LV CAN addresses straight to its parser through a CAN_Dispatcher
+    uint32_t dataAgeUs(){ return receiveClock.ageUs(); }                        //See CAN_ReceiveClock::ageUs
+    bool isFresh(uint32_t timeoutMs){ return receiveClock.isFresh(timeoutMs); }  //See CAN_ReceiveClock::isFresh. The *Received flags never go back to false.
+    void receiveHVCANData(const LV_CANMessage &msg);   //Takes messages from the HV CAN Bus and parses them into this object which can then be sent on the LV CAN Bus. Only the fields carried by msg are updated.
 };
\ No newline at end of file